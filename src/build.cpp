@@ -2,8 +2,12 @@
 #include "meta.cpp"
 #include "common.cpp"
 #include "string.cpp"
+#include "simd.cpp"
 #include "main.cpp"
 #include "window.cpp"
+#include "thread.cpp"
+#include "pool.cpp"
+#include "jit.cpp"
 
 
 #pragma clang diagnostic push
@@ -4,6 +4,18 @@
 
 
 
+u64 hash_combine(u64 seed, u64 v) {
+    // 64 bit variant of boost::hash_combine
+    seed ^= v + 0x9e3779b97f4a7c15ull + (seed << 12) + (seed >> 4);
+    return seed;
+}
+
+u64 next_power_of_two(u64 v) {
+    u64 p = 1;
+    while (p < v) p <<= 1;
+    return p;
+}
+
 void assert_function(const char *cond, const char *file, s32 line) {
     fprintf(stderr, "Assertion failed '%s' %s:%d\n", cond, file, line);
 #ifdef x86_64 
@@ -52,6 +52,8 @@ typedef double f64;
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(*(x)))
 
 void assert_function(const char *cond, const char *file, s32 line);
+u64 hash_combine(u64 seed, u64 v);
+u64 next_power_of_two(u64 v);
 #define assert(condition)                               \
 do {                                                    \
     if (!(condition)) {                                 \
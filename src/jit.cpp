@@ -0,0 +1,232 @@
+#include <string.h>
+#include "jit.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+void *jit_memory_reserve(u64 size) {
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+bool jit_memory_protect(void *memory, u64 size, bool executable) {
+    DWORD old = 0;
+    if (!VirtualProtect(memory, size, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &old)) return false;
+    if (executable) FlushInstructionCache(GetCurrentProcess(), memory, size);
+    return true;
+}
+
+void jit_memory_release(void *memory, u64) {
+    VirtualFree(memory, 0, MEM_RELEASE);
+}
+#else
+#include <sys/mman.h>
+
+void *jit_memory_reserve(u64 size) {
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? nullptr : memory;
+}
+
+bool jit_memory_protect(void *memory, u64 size, bool executable) {
+    return mprotect(memory, size, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+}
+
+void jit_memory_release(void *memory, u64 size) {
+    munmap(memory, size);
+}
+#endif
+
+
+void asm_init(Assembler *a, u8 *code, u64 cap) {
+    a->code = code;
+    a->count = 0;
+    a->cap = cap;
+    a->overflow = false;
+}
+
+void asm_u8(Assembler *a, u8 v) {
+    if (a->count >= a->cap) {
+        a->overflow = true;
+        return;
+    }
+    a->code[a->count++] = v;
+}
+
+void asm_u32(Assembler *a, u32 v) {
+    for (u32 i = 0; i < 4; ++i) asm_u8(a, (u8)(v >> (i * 8)));
+}
+
+void asm_u64(Assembler *a, u64 v) {
+    for (u32 i = 0; i < 8; ++i) asm_u8(a, (u8)(v >> (i * 8)));
+}
+
+void asm_align(Assembler *a, u64 alignment) {
+    // int3 padding
+    while (a->count % alignment != 0 && !a->overflow) asm_u8(a, 0xCC);
+}
+
+// only emitted when one of the bits is needed
+void asm_rex(Assembler *a, bool w, u32 reg, u32 rm) {
+    u8 rex = (u8)(0x40 | (w ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1));
+    if (rex != 0x40) asm_u8(a, rex);
+}
+
+void asm_modrm_reg(Assembler *a, u32 reg, u32 rm) {
+    asm_u8(a, (u8)(0xC0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+// always disp32, rsp and r12 as base need a sib byte
+void asm_modrm_mem(Assembler *a, u32 reg, X64Reg base, s32 disp) {
+    asm_u8(a, (u8)(0x80 | (reg & 7) << 3 | (base & 7)));
+    if ((base & 7) == X64_RSP) asm_u8(a, 0x24);
+    asm_u32(a, (u32)disp);
+}
+
+void asm_sse_rr(Assembler *a, u8 prefix, u8 op, u32 xmm, u32 xmm_rm) {
+    asm_u8(a, prefix);
+    asm_rex(a, false, xmm, xmm_rm);
+    asm_u8(a, 0x0F);
+    asm_u8(a, op);
+    asm_modrm_reg(a, xmm, xmm_rm);
+}
+
+void asm_sse_rm(Assembler *a, u8 prefix, u8 op, u32 xmm, X64Reg base, s32 disp) {
+    asm_u8(a, prefix);
+    asm_rex(a, false, xmm, base);
+    asm_u8(a, 0x0F);
+    asm_u8(a, op);
+    asm_modrm_mem(a, xmm, base, disp);
+}
+
+void asm_sse_rip(Assembler *a, u8 prefix, u8 op, u32 xmm, u64 target) {
+    asm_u8(a, prefix);
+    asm_rex(a, false, xmm, 0);
+    asm_u8(a, 0x0F);
+    asm_u8(a, op);
+    asm_u8(a, (u8)(0x05 | (xmm & 7) << 3));
+    // relative to the end of the instruction, which is the end of the displacement
+    asm_u32(a, (u32)(s32)((s64)target - (s64)(a->count + 4)));
+}
+
+void asm_movq_xmm_gpr(Assembler *a, u32 xmm, X64Reg gpr) {
+    asm_u8(a, 0x66);
+    asm_rex(a, true, xmm, gpr);
+    asm_u8(a, 0x0F);
+    asm_u8(a, 0x6E);
+    asm_modrm_reg(a, xmm, gpr);
+}
+
+void asm_push(Assembler *a, X64Reg reg) {
+    asm_rex(a, false, 0, reg);
+    asm_u8(a, (u8)(0x50 + (reg & 7)));
+}
+
+void asm_pop(Assembler *a, X64Reg reg) {
+    asm_rex(a, false, 0, reg);
+    asm_u8(a, (u8)(0x58 + (reg & 7)));
+}
+
+void asm_mov_rr(Assembler *a, X64Reg dst, X64Reg src) {
+    asm_rex(a, true, src, dst);
+    asm_u8(a, 0x89);
+    asm_modrm_reg(a, src, dst);
+}
+
+void asm_mov_load(Assembler *a, X64Reg dst, X64Reg base, s32 disp) {
+    asm_rex(a, true, dst, base);
+    asm_u8(a, 0x8B);
+    asm_modrm_mem(a, dst, base, disp);
+}
+
+void asm_mov_imm64(Assembler *a, X64Reg dst, u64 imm) {
+    asm_rex(a, true, 0, dst);
+    asm_u8(a, (u8)(0xB8 + (dst & 7)));
+    asm_u64(a, imm);
+}
+
+void asm_mov_eax_imm(Assembler *a, u32 imm) {
+    asm_u8(a, 0xB8);
+    asm_u32(a, imm);
+}
+
+void asm_lea(Assembler *a, X64Reg dst, X64Reg base, s32 disp) {
+    asm_rex(a, true, dst, base);
+    asm_u8(a, 0x8D);
+    asm_modrm_mem(a, dst, base, disp);
+}
+
+void asm_alu_imm(Assembler *a, u32 ext, X64Reg reg, s32 imm) {
+    asm_rex(a, true, 0, reg);
+    asm_u8(a, 0x81);
+    asm_modrm_reg(a, ext, reg);
+    asm_u32(a, (u32)imm);
+}
+
+// flags of lhs - rhs
+void asm_cmp_rr(Assembler *a, X64Reg lhs, X64Reg rhs) {
+    asm_rex(a, true, rhs, lhs);
+    asm_u8(a, 0x39);
+    asm_modrm_reg(a, rhs, lhs);
+}
+
+void asm_cmp_mem32_imm8(Assembler *a, X64Reg base, s32 disp, s8 imm) {
+    asm_rex(a, false, 0, base);
+    asm_u8(a, 0x83);
+    asm_modrm_mem(a, X64_ALU_CMP, base, disp);
+    asm_u8(a, (u8)imm);
+}
+
+void asm_inc(Assembler *a, X64Reg reg) {
+    asm_rex(a, true, 0, reg);
+    asm_u8(a, 0xFF);
+    asm_modrm_reg(a, 0, reg);
+}
+
+void asm_dec(Assembler *a, X64Reg reg) {
+    asm_rex(a, true, 0, reg);
+    asm_u8(a, 0xFF);
+    asm_modrm_reg(a, 1, reg);
+}
+
+void asm_xor_eax(Assembler *a) {
+    asm_u8(a, 0x31);
+    asm_u8(a, 0xC0);
+}
+
+void asm_call_reg(Assembler *a, X64Reg reg) {
+    asm_rex(a, false, 0, reg);
+    asm_u8(a, 0xFF);
+    asm_modrm_reg(a, 2, reg);
+}
+
+void asm_ret(Assembler *a) {
+    asm_u8(a, 0xC3);
+}
+
+u64 asm_jcc(Assembler *a, u8 cc) {
+    asm_u8(a, 0x0F);
+    asm_u8(a, (u8)(0x80 | cc));
+    u64 at = a->count;
+    asm_u32(a, 0);
+    return at;
+}
+
+u64 asm_jmp(Assembler *a) {
+    asm_u8(a, 0xE9);
+    u64 at = a->count;
+    asm_u32(a, 0);
+    return at;
+}
+
+u64 asm_call(Assembler *a) {
+    asm_u8(a, 0xE8);
+    u64 at = a->count;
+    asm_u32(a, 0);
+    return at;
+}
+
+void asm_patch_rel32(Assembler *a, u64 at, u64 target) {
+    if (at + 4 > a->count) return;
+    s32 rel = (s32)((s64)target - (s64)(at + 4));
+    memcpy(a->code + at, &rel, sizeof(rel));
+}
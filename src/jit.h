@@ -0,0 +1,95 @@
+#pragma once
+#include "common.h"
+
+// pages for generated code, written while writable and run after jit_memory_protect(.., true)
+void *jit_memory_reserve(u64 size);
+bool jit_memory_protect(void *memory, u64 size, bool executable);
+void jit_memory_release(void *memory, u64 size);
+
+
+enum X64Reg {
+    X64_RAX,
+    X64_RCX,
+    X64_RDX,
+    X64_RBX,
+    X64_RSP,
+    X64_RBP,
+    X64_RSI,
+    X64_RDI,
+    X64_R8,
+    X64_R9,
+    X64_R10,
+    X64_R11,
+    X64_R12,
+    X64_R13,
+    X64_R14,
+    X64_R15,
+};
+
+// condition codes of jcc
+#define X64_CC_NE 0x5
+#define X64_CC_A 0x7
+#define X64_CC_S 0x8
+
+// mandatory prefixes and opcodes of the sse2 instructions used, the opcode follows 0x0F
+#define SSE_SD 0xF2
+#define SSE_PD 0x66
+#define SSE_DQU 0xF3
+
+#define SSE_MOVSD_LOAD 0x10
+#define SSE_MOVSD_STORE 0x11
+#define SSE_MOVAPD 0x28
+#define SSE_XORPD 0x57
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5C
+#define SSE_DIV 0x5E
+#define SSE_MOVDQU_LOAD 0x6F
+#define SSE_MOVDQU_STORE 0x7F
+
+// group 1 opcode extensions of asm_alu_imm
+#define X64_ALU_ADD 0
+#define X64_ALU_SUB 5
+#define X64_ALU_CMP 7
+
+// x86-64 machine code written into a fixed buffer, overflow is set instead of writing past cap
+struct Assembler {
+    u8 *code;
+    u64 count;
+    u64 cap;
+    bool overflow;
+};
+
+void asm_init(Assembler *a, u8 *code, u64 cap);
+void asm_u8(Assembler *a, u8 v);
+void asm_u32(Assembler *a, u32 v);
+void asm_u64(Assembler *a, u64 v);
+void asm_align(Assembler *a, u64 alignment);
+
+// xmm op xmm, xmm op [base + disp] and xmm op [rip + to target], target is an offset into code
+void asm_sse_rr(Assembler *a, u8 prefix, u8 op, u32 xmm, u32 xmm_rm);
+void asm_sse_rm(Assembler *a, u8 prefix, u8 op, u32 xmm, X64Reg base, s32 disp);
+void asm_sse_rip(Assembler *a, u8 prefix, u8 op, u32 xmm, u64 target);
+void asm_movq_xmm_gpr(Assembler *a, u32 xmm, X64Reg gpr);
+
+void asm_push(Assembler *a, X64Reg reg);
+void asm_pop(Assembler *a, X64Reg reg);
+void asm_mov_rr(Assembler *a, X64Reg dst, X64Reg src);
+void asm_mov_load(Assembler *a, X64Reg dst, X64Reg base, s32 disp);
+void asm_mov_imm64(Assembler *a, X64Reg dst, u64 imm);
+void asm_mov_eax_imm(Assembler *a, u32 imm);
+void asm_lea(Assembler *a, X64Reg dst, X64Reg base, s32 disp);
+void asm_alu_imm(Assembler *a, u32 ext, X64Reg reg, s32 imm);
+void asm_cmp_rr(Assembler *a, X64Reg lhs, X64Reg rhs);
+void asm_cmp_mem32_imm8(Assembler *a, X64Reg base, s32 disp, s8 imm);
+void asm_inc(Assembler *a, X64Reg reg);
+void asm_dec(Assembler *a, X64Reg reg);
+void asm_xor_eax(Assembler *a);
+void asm_call_reg(Assembler *a, X64Reg reg);
+void asm_ret(Assembler *a);
+
+// emit a rel32 jump or call and return where the rel32 is so it can be pointed at a target later
+u64 asm_jcc(Assembler *a, u8 cc);
+u64 asm_jmp(Assembler *a);
+u64 asm_call(Assembler *a);
+void asm_patch_rel32(Assembler *a, u64 at, u64 target);
@@ -8,6 +8,10 @@
 #include "arena.h"
 #include "meta.h"
 #include "string.h"
+#include "simd.h"
+#include "thread.h"
+#include "pool.h"
+#include "jit.h"
 
 #include "window.h"
 #include "glad/glad.h"
@@ -16,22 +20,81 @@
 
 Window g_window = {};
 
+// grows geometrically, pointers into dat are invalidated by anything that grows it
 template <typename T>
 struct DynArray {
     u64 count;
     u64 cap;
     T *dat;
+    // allocates from arena when set, otherwise from the heap
+    Arena *arena;
 };
 template <typename T>
 void dynarray_init(DynArray<T> *dynarray, u64 cap) {
     dynarray->count = 0;
     dynarray->cap = cap;
     dynarray->dat = (T *)calloc(dynarray->cap, sizeof(T));
+    dynarray->arena = nullptr;
+}
+// nothing is allocated until the first append, the memory is released with the arena
+template <typename T>
+void dynarray_init_arena(DynArray<T> *dynarray, Arena *arena) {
+    dynarray->count = 0;
+    dynarray->cap = 0;
+    dynarray->dat = nullptr;
+    dynarray->arena = arena;
+}
+template <typename T>
+void dynarray_set_cap(DynArray<T> *dynarray, u64 cap) {
+    assert(cap >= dynarray->count);
+    if (dynarray->arena) {
+        Arena *arena = dynarray->arena;
+        u8 *end = (u8 *)(dynarray->dat + dynarray->cap);
+        // the last allocation in the arena is resized in place
+        if (dynarray->dat && align_to_8_boundry((u64)(end - arena->data)) == arena->pos) {
+            u64 start = (u64)((u8 *)dynarray->dat - arena->data);
+            if (start + cap * sizeof(T) <= arena->max_capacity) {
+                if (cap > dynarray->cap) memset(end, 0, (cap - dynarray->cap) * sizeof(T));
+                arena->pos = align_to_8_boundry(start + cap * sizeof(T));
+                dynarray->cap = cap;
+                return;
+            }
+        }
+        if (cap <= dynarray->cap) return;
+        T *dat = (T *)arena_alloc(arena, cap * sizeof(T));
+        assert(dat);
+        if (dynarray->count > 0) memcpy(dat, dynarray->dat, dynarray->count * sizeof(T));
+        dynarray->dat = dat;
+    } else {
+        if (cap == 0) {
+            free(dynarray->dat);
+            dynarray->dat = nullptr;
+            dynarray->cap = 0;
+            return;
+        }
+        T *dat = (T *)realloc(dynarray->dat, cap * sizeof(T));
+        assert(dat);
+        if (cap > dynarray->cap) memset(dat + dynarray->cap, 0, (cap - dynarray->cap) * sizeof(T));
+        dynarray->dat = dat;
+    }
+    dynarray->cap = cap;
+}
+template <typename T>
+void dynarray_reserve(DynArray<T> *dynarray, u64 cap) {
+    if (cap <= dynarray->cap) return;
+    u64 new_cap = dynarray->cap * 2;
+    if (new_cap < 16) new_cap = 16;
+    if (new_cap < cap) new_cap = cap;
+    dynarray_set_cap(dynarray, new_cap);
+}
+// gives back the memory past count, arena memory is only returned when dat is the last allocation
+template <typename T>
+void dynarray_shrink(DynArray<T> *dynarray) {
+    if (dynarray->cap > dynarray->count) dynarray_set_cap(dynarray, dynarray->count);
 }
 template <typename T>
 void dynarray_append(DynArray<T> *dynarray, T v) {
-    if (dynarray->cap == 0) dynarray_init(dynarray, 1 << 14);
-    assert(dynarray->count < dynarray->cap);
+    if (dynarray->count == dynarray->cap) dynarray_reserve(dynarray, dynarray->count + 1);
     dynarray->dat[dynarray->count++] = v;
 }
 template <typename T>
@@ -82,19 +145,59 @@ struct Lexer {
 struct Item {
     ItemType type;
     String name;
+    u32 name_id;
     u64 func_args;
     u64 id;
 };
 
+// open addressed on Item::name_id, empty slots are ITEM_INVALID
 struct Scope {
-    DynArray<Item> items;
+    Scope *parent;
+    u64 cap;
+    u64 count;
+    Item *items;
+};
+
+struct InternEntry {
+    // range of the name in Interner::chars
+    u64 start;
+    u64 count;
+    u64 hash;
+};
+
+// maps every distinct identifier to a small id, ids stay valid until reset_interpreter
+struct Interner {
+    // id + 1 open addressed on the hash of the name, 0 is empty, only cap is used
+    DynArray<u32> slots;
+    DynArray<InternEntry> entries;
+    DynArray<u8> chars;
+};
+
+enum FoldState {
+    FOLD_NOT_VISITED,
+    FOLD_VISITING,
+    FOLD_DONE,
 };
 
 struct Node {
     NodeType type;
     u64 token_index;
-
-    Scope scope;
+    // source text of token_index, later passes use it so the tokens are only needed while parsing
+    String text;
+
+    // value of NODE_NUMBER
+    f64 number;
+    // only used on definitions by the fold pass
+    FoldState fold_state;
+    // only used on definitions by the inline pass
+    FoldState inline_state;
+    // set by the cse pass, parents sharing the node and its local + 1 while its function is emitted
+    u32 cse_uses;
+    u32 cse_local;
+
+    // set by the typechecker for identifiers
+    u32 name_id;
+    Scope *scope;
 
     u64 node_count;
     Node **nodes;
@@ -120,6 +223,118 @@ struct Bytecode {
     StackData imm;
 };
 
+struct RegBytecode {
+    RegBytecodeType type;
+    u32 dst;
+    u32 a;
+    u32 b;
+    StackData imm;
+};
+
+struct RegFrame {
+    u64 return_address;
+    u64 base;
+};
+
+// a value is the index of the instruction defining it in Ir::insts, a and b are the operands.
+// IR_PARAM has the parameter index in a, IR_CONST the number and IR_GLOBAL the global id in imm.
+// IR_CALL reads its arguments from Ir::call_args[a .. a + b) and imm.u is the callee symbol index
+struct IrInst {
+    IrOp op;
+    u32 a;
+    u32 b;
+    StackData imm;
+};
+
+// the instructions of one symbol are insts[first .. first + count), the first arg_count of them
+// are the IR_PARAMs in order. There are no branches so a function is one block
+struct IrFunction {
+    u32 first;
+    u32 count;
+    u32 arg_count;
+    u32 result;
+};
+
+struct IrPassStats {
+    u64 runs;
+    f64 seconds;
+    // instructions of the whole program around the last run
+    u64 insts_before;
+    u64 insts_after;
+};
+
+// ssa form of every symbol between the tree and the register bytecode. Passes write a new
+// program into the scratch arrays and swap, the memory is kept across compiles
+struct Ir {
+    DynArray<IrInst> insts;
+    DynArray<u32> call_args;
+    // parallel to Program::symbols
+    DynArray<IrFunction> functions;
+
+    DynArray<IrInst> next_insts;
+    DynArray<u32> next_call_args;
+    // old value to new value while a pass rewrites, also used for last uses and registers
+    DynArray<u32> map;
+    DynArray<u32> values;
+    DynArray<u32> table;
+
+    IrPassStats passes[IrPass_COUNT];
+};
+
+struct GlobalCacheEntry {
+    u64 hash;
+    StackData value;
+    // definition_key of the global in the keys of its cache
+    u64 key_start;
+    u64 key_count;
+};
+
+enum VisitState {
+    VISIT_NONE,
+    VISIT_ACTIVE,
+    VISIT_DONE,
+};
+
+struct DefinitionState {
+    VisitState hash_state;
+    u64 hash;
+    VisitState eval_state;
+    u64 walk_mark;
+    // index + 1 of the EvalTask computing its value, 0 when there is none
+    u64 eval_task;
+    // number of the definition in the definition_key being built when key_mark is the walk_mark
+    u64 key_mark;
+    u64 key_index;
+};
+
+// one value on the batch stack is a block of BATCH_LANES lanes
+#define BATCH_LANES 256
+#define BATCH_STACK_SLOTS 1024
+
+struct BatchFrame {
+    u64 return_address;
+    u64 base;
+};
+
+// a call of the stack vms, base is where the locals of the callee start and its arguments end
+struct CallFrame {
+    u64 return_address;
+    u64 base;
+};
+
+// bytecode translated to handler addresses for the threaded vm
+struct ThreadedCode {
+    const void *handler;
+    StackData imm;
+};
+
+// limits of one execute_resume call, 0 is no limit. Executions only stop at a call so the
+// instruction budget can be overrun by the length of one function
+struct ExecuteBudget {
+    u64 instructions;
+    f64 seconds;
+};
+
 struct Error {
     bool has_statement;
     u64 statement_id;
@@ -134,24 +349,282 @@ struct Error {
 };
 
 
-struct Interpreter {
+enum UnitStage {
+    UNIT_PARSED,
+    UNIT_TYPECHECKED,
+    UNIT_FOLDED,
+};
 
-    String src;
-    Lexer lex;
-    Parser ctx;
+struct StatementResult {
+    // value of a global or of an expression statement
+    bool has_value;
+    StackData value;
+    // Merkle hash of a definition from hash_definition
+    bool has_hash;
+    u64 hash;
+};
+
+// symbol index + 1 of every symbol open addressed on the hash of its name, 0 is empty
+struct SymbolMap {
+    u64 cap;
+    u64 *slots;
+};
+
+// index of a function, global or statement in Program::symbols, symbol i belongs to statement i
+// so the handle of a statement is its index. Valid until the next compile
+typedef u64 FunctionHandle;
+#define FUNCTION_HANDLE_INVALID (~0ull)
+
+// everything execution reads, written by bytecode_from_tree and evaluate_globals and left alone
+// until the next compile so any number of ExecutionContexts can run it at the same time
+struct Program {
     DynArray<Bytecode> bytecode;
+    // node each instruction was emitted for, parallel to bytecode. Its text and token_index are
+    // in the source it was parsed from, Interpreter::src or the text of a unit
+    DynArray<Node *> source_map;
 
     DynArray<u64> symbol_ids;
     DynArray<String> symbols;
+    // parallel to symbols
+    DynArray<u64> symbol_arg_counts;
+    SymbolMap symbol_map;
+    // deepest the operand stack of each function gets above its base, parallel to symbols.
+    // Written by verify_bytecode, max_stack_depth is the largest of them
+    DynArray<u64> stack_depths;
+    u64 max_stack_depth;
+
+    // register vm code, reg_symbol_ids and reg_frame_sizes are parallel to symbols
+    DynArray<RegBytecode> reg_bytecode;
+    DynArray<u64> reg_symbol_ids;
+    DynArray<u64> reg_frame_sizes;
+
+    // parallel to bytecode
+    DynArray<ThreadedCode> threaded_code;
+
+    // bytecode from compact_program with one byte opcodes, the constants of BYTECODE_PUSH are
+    // indices into constants. compact_symbol_ids is parallel to symbols and in bytes
+    DynArray<u8> compact_code;
+    DynArray<StackData> constants;
+    DynArray<u64> compact_symbol_ids;
+
+    // native code from jit_program, kept across compiles and only rewritten. jit_offsets is
+    // parallel to symbols, has_jit is false when there is no usable code
+    u8 *jit_memory;
+    u64 jit_capacity;
+    u64 jit_entry_offset;
+    DynArray<u64> jit_offsets;
+    bool has_jit;
+
+    // values of global variables indexed by the Item::id of ITEM_GLOBALVARIABLE
+    DynArray<StackData> globals;
+};
 
-    Arena func_arena;
+// instrumentation of the stack vm, every instruction checks for a profile when it is built in.
+// Build with -D HAS_PROFILER=1 to profile
+#ifndef HAS_PROFILER
+#define HAS_PROFILER 0
+#endif
+
+#if HAS_PROFILER
+struct ProfileFunction {
+    u64 calls;
+    // run in the function itself, not in its callees
+    u64 instructions;
+    // from call to return, total includes the callees and counts recursive calls once per level
+    f64 total_seconds;
+    f64 self_seconds;
+};
+
+// a call of a profiled execution that has not returned
+struct ProfileCall {
+    u64 symbol_index;
+    f64 start;
+    f64 callee_seconds;
+};
+
+// what executions with ExecutionContext::profile set have done since profile_reset. They run on
+// the stack vm whatever mode they ask for, so every instruction is a BytecodeType
+struct Profile {
+    u64 executions;
+    u64 opcode_counts[BytecodeType_COUNT];
+    // parallel to the symbols of the program profiled last
+    DynArray<ProfileFunction> functions;
+    DynArray<ProfileCall> calls;
+    // values on the stack of one execution, the arguments of the entry function included
+    u64 max_stack_depth;
+    // calls below the entry function
+    u64 max_call_depth;
+};
+#endif
+
+#define SAMPLE_INTERVAL 1024
+
+// where executions with ExecutionContext::samples set are every interval instructions, they run
+// on the stack vm. A sample is the pc and then the call of each frame below it up to the entry
+// function, sample i is frames[sample_ends[i - 1]..sample_ends[i]]. Addresses are into the
+// bytecode of the Program that was sampled
+struct Samples {
+    u64 interval;
+    u64 countdown;
+    DynArray<u64> frames;
+    DynArray<u64> sample_ends;
+};
+
+// state of one execution of a Program, a suspended one continues from here on the next
+// execute_resume. Every thread evaluating a Program needs its own
+struct ExecutionContext {
+    ExecuteStatus status;
+    VmMode vm_mode;
+    u64 symbol_index;
 
     u64 program_counter;
-    u64 return_address;
     u64 base_stackframe_index;
+    u64 register_base;
+    u64 instructions;
+
+    // calls below the entry function before an execution fails, 0 and anything above
+    // MAX_CALL_DEPTH is MAX_CALL_DEPTH
+    u64 max_call_depth;
+
+    // restored when the execution ends or is dropped
+    u64 entry_stack_count;
+    u64 entry_base;
+
+    // of the last execution that ended with EXECUTE_ERROR
+    Error error;
+
+    // set by another thread to stop execute_program after the current slice
+    volatile u32 *cancel;
+
+#if HAS_PROFILER
+    // executions are counted into it when set
+    Profile *profile;
+#endif
+    // executions are sampled into it when set
+    Samples *samples;
+
+    // VM_JIT runs every call on the register vm too and fails unless the results are the same bits
+    bool jit_differential;
+    DynArray<StackData> jit_args;
 
     DynArray<StackData> stack;
+    // of the stack vms, the entry function included. Reserved for the deepest execution allowed
+    // up front so calls never grow it
+    DynArray<CallFrame> frames;
+
+    DynArray<StackData> registers;
+    DynArray<RegFrame> reg_frames;
+
+    DynArray<f64> batch_stack;
+    DynArray<BatchFrame> batch_frames;
+};
+
+// one independently edited piece of source, its statements are only compiled again when
+// its text changes or a definition it reads does
+struct Unit {
+    DynArray<u8> text;
+    bool changed;
+    UnitStage stage;
+    // results have to be evaluated again
+    bool stale;
+
+    // tokens and nodes of the statements
+    Arena arena;
+    DynArray<Node *> statements;
     DynArray<Error> errors;
+    // parallel to statements
+    DynArray<StatementResult> results;
+
+    // interned names the statements define and the program level names they read
+    DynArray<u32> defines;
+    DynArray<u32> reads;
+
+    // sizes of the last parse
+    u64 token_count;
+    u64 node_count;
+    // calls replaced by the body of the callee when the unit was last inlined
+    u64 inlined_calls;
+};
+
+// measurements of the last compile or compile_units. The sizes are of the whole program, units
+// that were not parsed again count with their last parse
+struct CompileMetrics {
+    f64 phase_seconds[CompilePhase_COUNT];
+    f64 total_seconds;
+    u64 units_parsed;
+
+    u64 tokens;
+    u64 nodes;
+    u64 scope_items;
+    u64 inlined_calls;
+    u64 bytecode_count;
+    u64 bytecode_bytes;
+    u64 compact_bytes;
+    u64 func_arena_bytes;
+    u64 node_arena_bytes;
+
+    // since the interpreter was made
+    u64 compiles;
+};
+
+struct Interpreter {
+
+    String src;
+    Lexer lex;
+    Parser ctx;
+    Interner interner;
+    Scope program_scope;
+    DynArray<Unit> units;
+    Program program;
+    Ir ir;
+
+    // statement of every global variable indexed by the Item::id of ITEM_GLOBALVARIABLE
+    DynArray<u64> global_statements;
+
+    // indexed by statement, only used while compiling
+    DynArray<DefinitionState> definition_states;
+    u64 walk_mark;
+
+    // values of globals from the previous compile, keyed by the hash of their definition and everything it uses
+    DynArray<GlobalCacheEntry> global_cache;
+    DynArray<GlobalCacheEntry> global_cache_next;
+    DynArray<u64> global_keys;
+    DynArray<u64> global_keys_next;
+    // index + 1 of the entries of global_cache, open addressed on the hash
+    DynArray<u32> global_cache_table;
+
+    Arena func_arena;
+
+    VmMode vm_mode;
+
+    // runs the statements while compiling
+    ExecutionContext exec;
+
+    // runs independent statements and big batches on its workers when set, pool_exec has one
+    // context per worker
+    Pool *pool;
+    DynArray<ExecutionContext> pool_exec;
+
+    DynArray<Error> errors;
+
+    CompileMetrics metrics;
+
+    // calls replaced by the body of the callee in the last compile, compile_units only inlines
+    // the units it compiles again so CompileMetrics::inlined_calls has the whole program
+    u64 inlined_calls;
+    // opcode pairs the peephole pass has seen since the interpreter was made, before fusing
+    u64 bytecode_pairs[BytecodeType_COUNT][BytecodeType_COUNT];
+
+    // set by another thread to stop compile_units at the next unit or statement
+    volatile u32 *cancel;
+
+#if HAS_PROFILER
+    // counts the executions of execute and execute_handle when set
+    Profile *profile;
+#endif
+    // samples the executions of execute, execute_handle and of the statements in compile and
+    // compile_units when set, statements are then evaluated one at a time
+    Samples *samples;
 };
 
 
@@ -159,7 +632,6 @@ struct Interpreter {
 
 TODO:
 add ability to actually run functions and expressions
-separate work thread from ui thread for more heavy tasks for example, running functions in the graph view.
 
 make ui scale correctly according to window size
 chained equality (checking for equality at every step in some list of expressions)
@@ -179,12 +651,11 @@ add graph viewer similar to desmos
 */
 
 void string_builder_append(DynArray<u8> *sb, u8 b) {
-    assert(sb->count < sb->cap);
-    sb->dat[sb->count++] = b;
+    dynarray_append(sb, b);
 }
 
 void string_builder_concat(DynArray<u8> *sb, String s) {
-    assert(sb->count + s.count < sb->cap);
+    dynarray_reserve(sb, sb->count + s.count);
     for (u64 i = 0; i < s.count; ++i) {
         sb->dat[sb->count++] = s.dat[i];
     }
@@ -327,11 +798,19 @@ u64 consume(Interpreter *inter) {
     return token_index;
 }
 
+f64 number_from_token(Interpreter *inter, u64 token_index) {
+    String num = string_from_token(inter, token_index);
+    char buf[32] = {};
+    snprintf(buf, sizeof(buf), "%.*s", (s32)num.count, num.dat);
+    return atof(buf);
+}
+
 Node *make_number(Interpreter *inter, u64 token_index) {
     Node *n = (Node *)arena_alloc(&inter->ctx.node_arena, sizeof(*n));
 
     n->type = NODE_NUMBER;
     n->token_index = token_index;
+    n->number = number_from_token(inter, token_index);
     return n;
 }
 
@@ -809,6 +1288,13 @@ void parse_statement(Interpreter *inter) {
 }
 
 
+void set_node_text(Interpreter *inter, Node *n) {
+    n->text = string_from_token(inter, n->token_index);
+    for (u64 i = 0; i < n->node_count; ++i) {
+        set_node_text(inter, n->nodes[i]);
+    }
+}
+
 void parse(Interpreter *inter) {
     Node *prog = (Node *)arena_alloc(&inter->ctx.node_arena, sizeof(*prog));
     prog->type = NODE_PROGRAM;
@@ -829,6 +1315,7 @@ void parse(Interpreter *inter) {
 
     for (u64 i = prog->node_count; i-- > 0;) {
         prog->nodes[i] = dynarray_pop(&inter->ctx.node_stack);
+        set_node_text(inter, prog->nodes[i]);
     }
 
     inter->ctx.root = prog;
@@ -840,7 +1327,9 @@ void graphviz_out(Interpreter *inter) {
     fprintf(f, "digraph G {\n");
 
 
+    u64 tmp = arena_get_pos(&inter->ctx.node_arena);
     DynArray<Node *> stack = {};
+    dynarray_init_arena(&stack, &inter->ctx.node_arena);
 
     dynarray_append(&stack, inter->ctx.root);
 
@@ -859,115 +1348,211 @@ void graphviz_out(Interpreter *inter) {
 
     fprintf(f, "}");
     fclose(f);
+    arena_set_pos(&inter->ctx.node_arena, tmp);
+}
+
+
+void interner_clear(Interner *in) {
+    in->entries.count = 0;
+    in->chars.count = 0;
+    if (in->slots.cap > 0) memset(in->slots.dat, 0, in->slots.cap * sizeof(*in->slots.dat));
+}
+
+String interned_name(Interner *in, InternEntry *entry) {
+    return String {in->chars.dat + entry->start, entry->count};
+}
+
+// returns the slot for name, either empty or holding the id of name
+u32 *interner_slot(Interner *in, String name, u64 hash) {
+    u64 mask = in->slots.cap - 1;
+    for (u64 i = hash & mask;; i = (i + 1) & mask) {
+        u32 *slot = in->slots.dat + i;
+        if (*slot == 0) return slot;
+        InternEntry *entry = in->entries.dat + (*slot - 1);
+        if (entry->hash == hash && string_equal(interned_name(in, entry), name)) return slot;
+    }
 }
 
+bool interner_find(Interner *in, String name, u32 *id_out) {
+    if (in->slots.cap == 0) return false;
+    u32 *slot = interner_slot(in, name, string_hash(name));
+    if (*slot == 0) return false;
+    *id_out = *slot - 1;
+    return true;
+}
+
+void interner_grow(Interner *in) {
+    dynarray_set_cap(&in->slots, in->slots.cap == 0 ? 64 : in->slots.cap * 2);
+    memset(in->slots.dat, 0, in->slots.cap * sizeof(*in->slots.dat));
+    for (u64 i = 0; i < in->entries.count; ++i) {
+        InternEntry *entry = in->entries.dat + i;
+        *interner_slot(in, interned_name(in, entry), entry->hash) = (u32)(i + 1);
+    }
+}
 
-Item *find_item_in_scope(String name, Scope *s) {
-    for (u64 i = 0; i < s->items.count; ++i) {
-        Item *active = s->items.dat + i;
-        if (string_equal(name, active->name)) {
-            return active;
+u32 intern(Interner *in, String name) {
+    u64 hash = string_hash(name);
+    if (in->slots.cap == 0) interner_grow(in);
+    u32 *slot = interner_slot(in, name, hash);
+    if (*slot == 0) {
+        if (in->entries.count + 1 > in->slots.cap / 2) {
+            interner_grow(in);
+            slot = interner_slot(in, name, hash);
         }
+        // names are copied so ids outlive the source they came from
+        InternEntry entry = {in->chars.count, name.count, hash};
+        dynarray_reserve(&in->chars, in->chars.count + name.count);
+        memcpy(in->chars.dat + in->chars.count, name.dat, name.count);
+        in->chars.count += name.count;
+        dynarray_append(&in->entries, entry);
+        *slot = (u32)in->entries.count;
+    }
+    return *slot - 1;
+}
+
+void init_scope(Scope *s, Arena *arena, Scope *parent, u64 max_items) {
+    s->parent = parent;
+    s->cap = next_power_of_two(max_items * 2 + 4);
+    s->count = 0;
+    s->items = (Item *)arena_alloc(arena, s->cap * sizeof(*s->items));
+}
+
+Scope *make_scope(Arena *arena, Scope *parent, u64 max_items) {
+    Scope *s = (Scope *)arena_alloc(arena, sizeof(*s));
+    init_scope(s, arena, parent, max_items);
+    return s;
+}
+
+Item *scope_slot(Scope *s, u32 name_id) {
+    u64 mask = s->cap - 1;
+    for (u64 i = hash_combine(0, name_id) & mask;; i = (i + 1) & mask) {
+        Item *item = s->items + i;
+        if (item->type == ITEM_INVALID || item->name_id == name_id) return item;
     }
+}
+
+// returns the existing item if name_id is already declared in s
+Item *scope_put(Scope *s, Item item) {
+    Item *slot = scope_slot(s, item.name_id);
+    if (slot->type != ITEM_INVALID) return slot;
+    assert(s->count < s->cap / 2);
+    *slot = item;
+    s->count += 1;
     return nullptr;
 }
 
-void typecheck_tree2(Interpreter *inter, Node *n, Scope *prev_scope) {
-    if (prev_scope) {
-        for (u64 i = 0; i < prev_scope->items.count; ++i) {
-            Item *item = prev_scope->items.dat + i;
-            dynarray_append(&n->scope.items, *item);
+// searches s and then its parents
+Item *find_item(Scope *s, u32 name_id) {
+    for (; s; s = s->parent) {
+        Item *item = scope_slot(s, name_id);
+        if (item->type != ITEM_INVALID) return item;
+    }
+    return nullptr;
+}
+
+// fills inter->program_scope with the definitions of prog, the items live in arena
+void build_program_scope(Interpreter *inter, Node *prog, Arena *arena) {
+    prog->scope = &inter->program_scope;
+    init_scope(prog->scope, arena, nullptr, prog->node_count);
+    for (u64 i = 0; i < prog->node_count; ++i) {
+        Node *node = prog->nodes[i];
+        assert(node->type == NODE_STATEMENT && node->node_count == 1);
+        Node *inner = node->nodes[0];
+        Item item = {};
+        if (inner->type == NODE_FUNCTIONDEF) {
+            item.type = ITEM_FUNCTION;
+            item.func_args = inner->node_count - 1;
+            item.id = i;
+        } else if (inner->type == NODE_VARIABLEDEF) {
+            item.type = ITEM_GLOBALVARIABLE;
+            item.id = inter->global_statements.count;
+            dynarray_append(&inter->global_statements, i);
+        } else {
+            continue;
         }
+        item.name = inner->text;
+        item.name_id = intern(&inter->interner, item.name);
+        inner->name_id = item.name_id;
+        // the first definition of a name wins
+        scope_put(prog->scope, item);
     }
+}
+
+void typecheck_tree2(Interpreter *inter, Node *n, Scope *prev_scope) {
+    n->scope = prev_scope;
     switch (n->type) {
         case NODE_INVALID: assert(false && "unreachable"); break;
         case NODE_PROGRAM: {
+            build_program_scope(inter, n, &inter->ctx.node_arena);
             for (u64 i = 0; i < n->node_count; ++i) {
-                Node *node = n->nodes[i];
-                if (node->type == NODE_STATEMENT) {
-                    assert(node->node_count == 1);
-                    Node *inner = node->nodes[0];
-                    Item item = {};
-                    if (inner->type == NODE_FUNCTIONDEF) {
-                        item.type = ITEM_FUNCTION;
-                        item.name = string_from_token(inter, inner->token_index);
-                        item.func_args = inner->node_count - 1;
-                    } else if (inner->type == NODE_VARIABLEDEF) {
-                        item.type = ITEM_GLOBALVARIABLE;
-                        item.name = string_from_token(inter, inner->token_index);
-                    }
-                    dynarray_append(&n->scope.items, item);
-                }
-            }
-            for (u64 i = 0; i < n->node_count; ++i) {
-                typecheck_tree2(inter, n->nodes[i], &n->scope);
+                typecheck_tree2(inter, n->nodes[i], n->scope);
             }
         } break;
         case NODE_STATEMENT: {
             assert(n->node_count == 1);
-            typecheck_tree2(inter, n->nodes[0], &n->scope);
+            typecheck_tree2(inter, n->nodes[0], n->scope);
         } break;
         case NODE_NUMBER: {
             // do nothing
         } break;
         case NODE_FUNCTION: {
-            String name = string_from_token(inter, n->token_index);
+            n->name_id = intern(&inter->interner, n->text);
 
-            Item *item = find_item_in_scope(name, &n->scope);
+            Item *item = find_item(n->scope, n->name_id);
             if (!item) {
                 Error err = {};
                 err.err_string = str_lit("Undeclared symbol f");
                 dynarray_append(&inter->errors, err);
                 return;
             }
-            if (string_equal(name, item->name)) {
-                if (item->type != ITEM_FUNCTION) {
-                    // wrong type
-                    todo();
-                }
-                if (n->node_count > item->func_args) {
-                    // too many args
-                    Error err = {};
-                    err.err_string = str_lit("Too many arguments in function ");
-                    err.token_id = n->token_index;
-                    err.has_token = true;
-                    dynarray_append(&inter->errors, err);
-                    return;
-                }
-                if (n->node_count < item->func_args) {
-                    // too few args
-                    Error err = {};
-                    err.err_string = str_lit("Too few arguments in function ");
-                    err.token_id = n->token_index;
-                    err.has_token = true;
-                    dynarray_append(&inter->errors, err);
-                    return;
-                }
+            if (item->type != ITEM_FUNCTION) {
+                // wrong type
+                todo();
+            }
+            if (n->node_count > item->func_args) {
+                // too many args
+                Error err = {};
+                err.err_string = str_lit("Too many arguments in function ");
+                err.token_id = n->token_index;
+                err.has_token = true;
+                dynarray_append(&inter->errors, err);
+                return;
+            }
+            if (n->node_count < item->func_args) {
+                // too few args
+                Error err = {};
+                err.err_string = str_lit("Too few arguments in function ");
+                err.token_id = n->token_index;
+                err.has_token = true;
+                dynarray_append(&inter->errors, err);
+                return;
             }
             for (u64 i = 0; i < n->node_count; ++i) {
-                typecheck_tree2(inter, n->nodes[i], &n->scope);
+                typecheck_tree2(inter, n->nodes[i], n->scope);
             }
         } break;
         case NODE_FUNCTIONDEF: {
+            n->scope = make_scope(&inter->ctx.node_arena, prev_scope, n->node_count - 1);
             for (u64 i = 0; i < n->node_count - 1; ++i) {
                 Node *var = n->nodes[i];
+                var->name_id = intern(&inter->interner, var->text);
+                var->scope = n->scope;
                 Item item = {};
                 item.type = ITEM_VARIABLE;
-                item.name = string_from_token(inter, var->token_index);
+                item.name = var->text;
+                item.name_id = var->name_id;
                 item.id = i;
-                // shadow declaration if it already exists
-                Item *old = find_item_in_scope(item.name, &n->scope);
+                // shadows definitions in the parent scopes, a repeated parameter replaces the earlier one
+                Item *old = scope_put(n->scope, item);
                 if (old) {
                     *old = item;
-                } else {
-                    dynarray_append(&n->scope.items, item);
                 }
             }
-            typecheck_tree2(inter, n->nodes[n->node_count - 1], &n->scope);
+            typecheck_tree2(inter, n->nodes[n->node_count - 1], n->scope);
         } break;
         case NODE_VARIABLE: {
-            String name = string_from_token(inter, n->token_index);
-            Item *item = find_item_in_scope(name, &n->scope);
+            n->name_id = intern(&inter->interner, n->text);
+            Item *item = find_item(n->scope, n->name_id);
             if (!item) {
                 Error err = {};
                 err.err_string = str_lit("Undeclared variable");
@@ -976,33 +1561,31 @@ void typecheck_tree2(Interpreter *inter, Node *n, Scope *prev_scope) {
                 dynarray_append(&inter->errors, err);
                 return;
             }
-            if (string_equal(name, item->name)) {
-                if (item->type != ITEM_VARIABLE && item->type != ITEM_GLOBALVARIABLE) {
-                    // wrong type
-                    Error err = {};
-                    err.token_id = n->token_index;
-                    err.has_token = true;
-                    err.err_string = str_lit("Tried to use non variable as a variable");
-                    dynarray_append(&inter->errors, err);
-                    return;
-                }
+            if (item->type != ITEM_VARIABLE && item->type != ITEM_GLOBALVARIABLE) {
+                // wrong type
+                Error err = {};
+                err.token_id = n->token_index;
+                err.has_token = true;
+                err.err_string = str_lit("Tried to use non variable as a variable");
+                dynarray_append(&inter->errors, err);
+                return;
             }
         } break;
         case NODE_VARIABLEDEF: {
-            typecheck_tree2(inter, n->nodes[0], &n->scope);
+            typecheck_tree2(inter, n->nodes[0], n->scope);
         } break;
         case NODE_ADD:
         case NODE_SUB:
         case NODE_MUL:
         case NODE_DIV: {
             assert(n->node_count == 2);
-            typecheck_tree2(inter, n->nodes[0], &n->scope);
-            typecheck_tree2(inter, n->nodes[1], &n->scope);
+            typecheck_tree2(inter, n->nodes[0], n->scope);
+            typecheck_tree2(inter, n->nodes[1], n->scope);
         } break;
         case NODE_UNARYADD:
         case NODE_UNARYSUB: {
             assert(n->node_count == 1);
-            typecheck_tree2(inter, n->nodes[0], &n->scope);
+            typecheck_tree2(inter, n->nodes[0], n->scope);
         } break;
         case NODE_OPENPAREN: assert(false && "unreachable"); break;
         case NodeType_COUNT: assert(false && "unreachable"); break;
@@ -1013,301 +1596,4503 @@ void typecheck_tree(Interpreter *inter) {
     typecheck_tree2(inter, inter->ctx.root, nullptr);
 }
 
-bool get_func_id_from_name(Interpreter *inter, String func, u64 *func_id_out) {
-    for (u64 i = 0; i < inter->symbols.count; ++i) {
-        if (string_equal(inter->symbols.dat[i], func)) {
-            *func_id_out = inter->symbol_ids.dat[i];
-            return true;
-        }
-    }
-    return false;
+Node *get_definition(Interpreter *inter, u64 statement_index) {
+    return inter->ctx.root->nodes[statement_index]->nodes[0];
 }
 
-void bytecode_from_tree2(Interpreter *inter, Node *n) {
+Node *get_item_definition(Interpreter *inter, Item *item) {
+    if (item->type == ITEM_FUNCTION) return get_definition(inter, item->id);
+    if (item->type == ITEM_GLOBALVARIABLE) return get_definition(inter, inter->global_statements.dat[item->id]);
+    return nullptr;
+}
+
+bool is_number(Node *n, f64 value) {
+    return n->type == NODE_NUMBER && n->number == value && signbit(n->number) == signbit(value);
+}
+
+Node *fold_tree2(Interpreter *inter, Node *n);
+
+void fold_definition(Interpreter *inter, Node *def) {
+    if (def->fold_state != FOLD_NOT_VISITED) return;
+    def->fold_state = FOLD_VISITING;
+    def->nodes[def->node_count - 1] = fold_tree2(inter, def->nodes[def->node_count - 1]);
+    def->fold_state = FOLD_DONE;
+}
+
+// value of a zero argument definition if its body folded to a constant
+bool get_constant_definition(Interpreter *inter, Item *item, f64 *value_out) {
+    if (!item) return false;
+    Node *def = get_item_definition(inter, item);
+    if (!def) return false;
+    if (def->node_count != 1) return false;
+
+    fold_definition(inter, def);
+    // a definition that refers to itself is still being folded
+    if (def->fold_state != FOLD_DONE) return false;
+
+    Node *body = def->nodes[0];
+    if (body->type != NODE_NUMBER) return false;
+    *value_out = body->number;
+    return true;
+}
+
+Node *make_folded_number(Node *n, f64 value) {
+    n->type = NODE_NUMBER;
+    n->number = value;
+    n->node_count = 0;
+    n->nodes = nullptr;
+    return n;
+}
+
+// returns the node replacing n, only identities that hold for every IEEE double are applied,
+// so x+0 is kept since -0+0 is +0 but x-0 and x+(-0) are removed
+Node *fold_tree2(Interpreter *inter, Node *n) {
     switch (n->type) {
         case NODE_INVALID: assert(false && "unreachable"); break;
         case NODE_PROGRAM: {
             for (u64 i = 0; i < n->node_count; ++i) {
-                bytecode_from_tree2(inter, n->nodes[i]);
+                fold_tree2(inter, n->nodes[i]);
             }
-
         } break;
         case NODE_STATEMENT: {
             assert(n->node_count == 1);
-            bool def = n->nodes[0]->type == NODE_FUNCTIONDEF || n->nodes[0]->type == NODE_VARIABLEDEF;
-            if (!def) {
-                String s = string_printf(&inter->func_arena, "_s%llu", inter->symbols.count);
-                dynarray_append(&inter->symbols, s);
-                dynarray_append(&inter->symbol_ids, inter->bytecode.count);
-            }
-            bytecode_from_tree2(inter, n->nodes[0]);
-            if (!def) {
-                StackData sd = {};
-                sd.u = 0;
-                dynarray_append(&inter->bytecode, {BYTECODE_RETURN, sd});
-            }
+            n->nodes[0] = fold_tree2(inter, n->nodes[0]);
         } break;
         case NODE_NUMBER: {
-            String num = string_from_token(inter, n->token_index);
-            char buf[32] = {};
-            snprintf(buf, sizeof(buf), "%.*s", (s32)num.count, num.dat);
-            StackData sd = {};
-            sd.f = atof(buf);
-
-            dynarray_append(&inter->bytecode, Bytecode {BYTECODE_PUSH, sd});
+            // do nothing
         } break;
         case NODE_FUNCTION: {
-            for (u64 i = n->node_count; i-- > 0;) {
-                bytecode_from_tree2(inter, n->nodes[i]);
+            for (u64 i = 0; i < n->node_count; ++i) {
+                n->nodes[i] = fold_tree2(inter, n->nodes[i]);
+            }
+            f64 value = 0;
+            if (n->node_count == 0 && get_constant_definition(inter, find_item(n->scope, n->name_id), &value)) {
+                return make_folded_number(n, value);
             }
-            String name = string_from_token(inter, n->token_index);
-            StackData func_id = {};
-            assert(get_func_id_from_name(inter, name, &func_id.u));
-
-            dynarray_append(&inter->bytecode, Bytecode {BYTECODE_CALL, func_id});
         } break;
-        case NODE_FUNCTIONDEF: {
-            String name = string_from_token(inter, n->token_index);
-            dynarray_append(&inter->symbols, name);
-            dynarray_append(&inter->symbol_ids, inter->bytecode.count);
-
-            bytecode_from_tree2(inter, n->nodes[n->node_count - 1]);
-            StackData num_args = {};
-            num_args.u = n->node_count - 1;
-            dynarray_append(&inter->bytecode, Bytecode {BYTECODE_RETURN, num_args});
+        case NODE_FUNCTIONDEF:
+        case NODE_VARIABLEDEF: {
+            fold_definition(inter, n);
         } break;
         case NODE_VARIABLE: {
-            String var_name = string_from_token(inter, n->token_index);
-            Item *item = find_item_in_scope(var_name, &n->scope);
-            assert(item);
-
-            if (item->type == ITEM_GLOBALVARIABLE) {
-                String name = string_from_token(inter, n->token_index);
-                StackData func_id = {};
-                assert(get_func_id_from_name(inter, name, &func_id.u));
-                dynarray_append(&inter->bytecode, Bytecode {BYTECODE_CALL, func_id});
-
-            } else if (item->type == ITEM_VARIABLE) {
-                StackData sd = {};
-                sd.u = item->id;
-                dynarray_append(&inter->bytecode, Bytecode {BYTECODE_PUSH_ARG, sd});
-            } else {
-                assert(false && "unreachable");
+            Item *item = find_item(n->scope, n->name_id);
+            f64 value = 0;
+            if (item && item->type == ITEM_GLOBALVARIABLE && get_constant_definition(inter, item, &value)) {
+                return make_folded_number(n, value);
             }
-
         } break;
-        case NODE_VARIABLEDEF: {
-            String name = string_from_token(inter, n->token_index);
-            dynarray_append(&inter->symbols, name);
-            dynarray_append(&inter->symbol_ids, inter->bytecode.count);
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_DIV: {
+            assert(n->node_count == 2);
+            Node *lhs = fold_tree2(inter, n->nodes[0]);
+            Node *rhs = fold_tree2(inter, n->nodes[1]);
+            n->nodes[0] = lhs;
+            n->nodes[1] = rhs;
+
+            if (lhs->type == NODE_NUMBER && rhs->type == NODE_NUMBER) {
+                f64 value = 0;
+                if (n->type == NODE_ADD) value = lhs->number + rhs->number;
+                if (n->type == NODE_SUB) value = lhs->number - rhs->number;
+                if (n->type == NODE_MUL) value = lhs->number * rhs->number;
+                if (n->type == NODE_DIV) value = lhs->number / rhs->number;
+                return make_folded_number(n, value);
+            }
 
-            assert(n->node_count == 1);
-            bytecode_from_tree2(inter, n->nodes[0]);
-            dynarray_append(&inter->bytecode, Bytecode {BYTECODE_RETURN, {}});
+            if (n->type == NODE_ADD) {
+                if (is_number(rhs, -0.0)) return lhs;
+                if (is_number(lhs, -0.0)) return rhs;
+            } else if (n->type == NODE_SUB) {
+                if (is_number(rhs, 0.0)) return lhs;
+            } else if (n->type == NODE_MUL) {
+                if (is_number(rhs, 1.0)) return lhs;
+                if (is_number(lhs, 1.0)) return rhs;
+                if (is_number(rhs, -1.0) || is_number(lhs, -1.0)) {
+                    n->type = NODE_UNARYSUB;
+                    n->node_count = 1;
+                    n->nodes[0] = is_number(rhs, -1.0) ? lhs : rhs;
+                    return n;
+                }
+            } else if (n->type == NODE_DIV) {
+                if (is_number(rhs, 1.0)) return lhs;
+            }
         } break;
-        case NODE_ADD: {
-            bytecode_from_tree2(inter, n->nodes[1]);
-            bytecode_from_tree2(inter, n->nodes[0]);
-            dynarray_append(&inter->bytecode, Bytecode {BYTECODE_ADD, {}});
+        case NODE_UNARYADD: {
+            assert(n->node_count == 1);
+            return fold_tree2(inter, n->nodes[0]);
         } break;
-        case NODE_SUB: {
-            bytecode_from_tree2(inter, n->nodes[1]);
-            bytecode_from_tree2(inter, n->nodes[0]);
-            dynarray_append(&inter->bytecode, Bytecode {BYTECODE_SUB, {}});
+        case NODE_UNARYSUB: {
+            assert(n->node_count == 1);
+            Node *operand = fold_tree2(inter, n->nodes[0]);
+            n->nodes[0] = operand;
+
+            if (operand->type == NODE_NUMBER) {
+                return make_folded_number(n, -operand->number);
+            }
+            if (operand->type == NODE_UNARYSUB) {
+                return operand->nodes[0];
+            }
         } break;
-        case NODE_MUL: {
-            bytecode_from_tree2(inter, n->nodes[1]);
-            bytecode_from_tree2(inter, n->nodes[0]);
-            dynarray_append(&inter->bytecode, Bytecode {BYTECODE_MUL, {}});
+        case NODE_OPENPAREN: assert(false && "unreachable"); break;
+        case NodeType_COUNT: assert(false && "unreachable"); break;
+    }
+    return n;
+}
+
+void fold_tree(Interpreter *inter) {
+    fold_tree2(inter, inter->ctx.root);
+}
+
+// callee bodies up to this many nodes are inlined
+#define INLINE_MAX_NODES 24
+// calls that come in with an inlined body are inlined too, up to this many levels
+#define INLINE_MAX_DEPTH 2
+
+u64 count_nodes(Node *n) {
+    u64 count = 1;
+    for (u64 i = 0; i < n->node_count; ++i) {
+        count += count_nodes(n->nodes[i]);
+    }
+    return count;
+}
+
+bool has_call(Node *n) {
+    if (n->type == NODE_FUNCTION) return true;
+    for (u64 i = 0; i < n->node_count; ++i) {
+        if (has_call(n->nodes[i])) return true;
+    }
+    return false;
+}
+
+// references of every parameter in the body of a definition, parameters are the only ITEM_VARIABLEs there
+void count_parameter_uses(Node *n, u64 *uses) {
+    if (n->type == NODE_VARIABLE) {
+        Item *item = find_item(n->scope, n->name_id);
+        if (item && item->type == ITEM_VARIABLE) uses[item->id] += 1;
+    }
+    for (u64 i = 0; i < n->node_count; ++i) {
+        count_parameter_uses(n->nodes[i], uses);
+    }
+}
+
+// copy of n in the node arena, parameter references are replaced by copies of args when set
+Node *clone_tree(Interpreter *inter, Node *n, Node **args) {
+    if (args && n->type == NODE_VARIABLE) {
+        Item *item = find_item(n->scope, n->name_id);
+        if (item && item->type == ITEM_VARIABLE) return clone_tree(inter, args[item->id], nullptr);
+    }
+    Node *copy = (Node *)arena_alloc(&inter->ctx.node_arena, sizeof(*copy));
+    *copy = *n;
+    if (n->node_count > 0) {
+        copy->nodes = (Node **)arena_alloc(&inter->ctx.node_arena, n->node_count * sizeof(*copy->nodes));
+        for (u64 i = 0; i < n->node_count; ++i) {
+            copy->nodes[i] = clone_tree(inter, n->nodes[i], args);
+        }
+    }
+    return copy;
+}
+
+// the body of a small callee with the arguments substituted, or nullptr. An argument used more
+// than once is only substituted when it is a number or a variable so nothing is computed twice,
+// and one that is never used only when it has no call, a call could be one that never returns
+Node *inline_call(Interpreter *inter, Node *call) {
+    Item *item = find_item(call->scope, call->name_id);
+    if (!item || item->type != ITEM_FUNCTION) return nullptr;
+    Node *def = get_definition(inter, item->id);
+    // the definition is being inlined into, so it's recursive
+    if (def->inline_state == FOLD_VISITING) return nullptr;
+    Node *body = def->nodes[def->node_count - 1];
+    if (count_nodes(body) > INLINE_MAX_NODES) return nullptr;
+
+    u64 arg_count = def->node_count - 1;
+    assert(call->node_count == arg_count);
+    u64 pos = arena_get_pos(&inter->func_arena);
+    u64 *uses = (u64 *)arena_alloc(&inter->func_arena, (arg_count + 1) * sizeof(u64));
+    count_parameter_uses(body, uses);
+    bool can_inline = true;
+    u64 copied_nodes = count_nodes(body);
+    for (u64 i = 0; i < arg_count; ++i) {
+        Node *arg = call->nodes[i];
+        bool is_leaf = arg->type == NODE_NUMBER || arg->type == NODE_VARIABLE;
+        if (uses[i] > 1 && !is_leaf) can_inline = false;
+        if (uses[i] == 0 && has_call(arg)) can_inline = false;
+        copied_nodes += uses[i] * count_nodes(arg);
+    }
+    arena_set_pos(&inter->func_arena, pos);
+    if (!can_inline) return nullptr;
+    // a node and its slot in the children of its parent, the arena of a unit has a fixed size
+    Arena *arena = &inter->ctx.node_arena;
+    if (copied_nodes * (sizeof(Node) + sizeof(Node *)) > arena->max_capacity - arena->pos) return nullptr;
+
+    inter->inlined_calls += 1;
+    return clone_tree(inter, body, call->nodes);
+}
+
+// returns the node replacing n
+Node *inline_tree2(Interpreter *inter, Node *n, u64 depth) {
+    for (u64 i = 0; i < n->node_count; ++i) {
+        n->nodes[i] = inline_tree2(inter, n->nodes[i], depth);
+    }
+    if (n->type != NODE_FUNCTION || depth >= INLINE_MAX_DEPTH) return n;
+
+    Node *inlined = inline_call(inter, n);
+    if (!inlined) return n;
+    Item *item = find_item(n->scope, n->name_id);
+    Node *def = get_definition(inter, item->id);
+    def->inline_state = FOLD_VISITING;
+    inlined = inline_tree2(inter, inlined, depth + 1);
+    def->inline_state = FOLD_NOT_VISITED;
+    // constant arguments usually make the body foldable
+    return fold_tree2(inter, inlined);
+}
+
+void inline_statement(Interpreter *inter, Node *statement) {
+    Node *inner = statement->nodes[0];
+    if (inner->type == NODE_FUNCTIONDEF || inner->type == NODE_VARIABLEDEF) {
+        // a definition calling itself is not inlined into itself
+        inner->inline_state = FOLD_VISITING;
+        inner->nodes[inner->node_count - 1] = inline_tree2(inter, inner->nodes[inner->node_count - 1], 0);
+        inner->inline_state = FOLD_NOT_VISITED;
+    } else {
+        statement->nodes[0] = inline_tree2(inter, inner, 0);
+    }
+}
+
+void inline_tree(Interpreter *inter) {
+    Node *prog = inter->ctx.root;
+    for (u64 i = 0; i < prog->node_count; ++i) {
+        inline_statement(inter, prog->nodes[i]);
+    }
+}
+
+// open addressed on the node and the pointers of its children, which are already the shared ones
+struct CseTable {
+    Node **slots;
+    u64 cap;
+};
+
+// what besides the type and the children makes two nodes the same, names are compared by what
+// they resolve to since an inlined body has the scope of the callee
+u64 cse_key(Node *n) {
+    if (n->type == NODE_NUMBER) {
+        StackData sd = {};
+        sd.f = n->number;
+        return sd.u;
+    }
+    if (n->type == NODE_VARIABLE || n->type == NODE_FUNCTION) {
+        Item *item = find_item(n->scope, n->name_id);
+        assert(item);
+        return (u64)item->type << 32 | item->id;
+    }
+    return 0;
+}
+
+bool cse_equal(Node *x, Node *y, u64 y_key) {
+    if (x->type != y->type || x->node_count != y->node_count) return false;
+    for (u64 i = 0; i < x->node_count; ++i) {
+        if (x->nodes[i] != y->nodes[i]) return false;
+    }
+    return cse_key(x) == y_key;
+}
+
+// returns the node replacing n, the first one seen of every structurally identical subtree
+Node *cse_tree2(CseTable *table, Node *n) {
+    for (u64 i = 0; i < n->node_count; ++i) {
+        n->nodes[i] = cse_tree2(table, n->nodes[i]);
+    }
+    u64 key = cse_key(n);
+    u64 h = hash_combine(hash_combine((u64)n->type, key), n->node_count);
+    for (u64 i = 0; i < n->node_count; ++i) {
+        h = hash_combine(h, (u64)n->nodes[i]);
+    }
+
+    u64 slot = h & (table->cap - 1);
+    while (table->slots[slot] && !cse_equal(table->slots[slot], n, key)) {
+        slot = (slot + 1) & (table->cap - 1);
+    }
+    Node *found = table->slots[slot];
+    if (found) {
+        // n is dropped so its children have one parent less
+        for (u64 i = 0; i < n->node_count; ++i) {
+            n->nodes[i]->cse_uses -= 1;
+        }
+        found->cse_uses += 1;
+        return found;
+    }
+    n->cse_uses = 1;
+    n->cse_local = 0;
+    table->slots[slot] = n;
+    return n;
+}
+
+// the body of a statement becomes a dag, shared nodes are computed once per call. Calls are
+// shared too since functions have no side effects
+void cse_statement(Interpreter *inter, Node *statement) {
+    Node *inner = statement->nodes[0];
+    Node **body = statement->nodes;
+    if (inner->type == NODE_FUNCTIONDEF || inner->type == NODE_VARIABLEDEF) {
+        body = inner->nodes + inner->node_count - 1;
+    }
+
+    u64 pos = arena_get_pos(&inter->func_arena);
+    CseTable table = {};
+    table.cap = next_power_of_two(count_nodes(*body) * 2);
+    table.slots = (Node **)arena_alloc(&inter->func_arena, table.cap * sizeof(*table.slots));
+    *body = cse_tree2(&table, *body);
+    arena_set_pos(&inter->func_arena, pos);
+}
+
+void cse_tree(Interpreter *inter) {
+    Node *prog = inter->ctx.root;
+    for (u64 i = 0; i < prog->node_count; ++i) {
+        cse_statement(inter, prog->nodes[i]);
+    }
+}
+
+// returns the slot for name, either empty or holding the first symbol called name
+u64 *symbol_map_slot(Program *program, String name) {
+    SymbolMap *map = &program->symbol_map;
+    u64 mask = map->cap - 1;
+    for (u64 i = string_hash(name) & mask;; i = (i + 1) & mask) {
+        u64 *slot = map->slots + i;
+        if (*slot == 0 || string_equal(program->symbols.dat[*slot - 1], name)) return slot;
+    }
+}
+
+void add_symbol(Program *program, String name, u64 arg_count) {
+    dynarray_append(&program->symbols, name);
+    dynarray_append(&program->symbol_ids, program->bytecode.count);
+    dynarray_append(&program->symbol_arg_counts, arg_count);
+    assert(program->symbols.count <= program->symbol_map.cap / 2);
+    u64 *slot = symbol_map_slot(program, name);
+    if (*slot == 0) {
+        *slot = program->symbols.count;
+    }
+}
+
+bool get_symbol_index_from_name(Program *program, String func, u64 *symbol_index_out) {
+    if (program->symbol_map.cap == 0) return false;
+    u64 *slot = symbol_map_slot(program, func);
+    if (*slot == 0) return false;
+    *symbol_index_out = *slot - 1;
+    return true;
+}
+
+
+void reg_emit(Interpreter *inter, RegBytecodeType type, u32 dst, u32 a, u32 b, StackData imm) {
+    RegBytecode code = {};
+    code.type = type;
+    code.dst = dst;
+    code.a = a;
+    code.b = b;
+    code.imm = imm;
+    dynarray_append(&inter->program.reg_bytecode, code);
+}
+
+u32 ir_emit(Ir *ir, IrOp op, u32 a, u32 b, StackData imm) {
+    IrInst inst = {};
+    inst.op = op;
+    inst.a = a;
+    inst.b = b;
+    inst.imm = imm;
+    dynarray_append(&ir->insts, inst);
+    return (u32)(ir->insts.count - 1);
+}
+
+// returns the value of n, first is the first instruction of the function being built
+u32 ir_from_tree2(Interpreter *inter, Node *n, u32 first) {
+    Ir *ir = &inter->ir;
+    switch (n->type) {
+        case NODE_NUMBER: {
+            StackData sd = {};
+            sd.f = n->number;
+            return ir_emit(ir, IR_CONST, 0, 0, sd);
+        } break;
+        case NODE_FUNCTION: {
+            // nested calls add their own arguments, so they are only copied to call_args at the end
+            u64 mark = ir->values.count;
+            for (u64 i = 0; i < n->node_count; ++i) {
+                u32 v = ir_from_tree2(inter, n->nodes[i], first);
+                dynarray_append(&ir->values, v);
+            }
+            u32 first_arg = (u32)ir->call_args.count;
+            for (u64 i = 0; i < n->node_count; ++i) {
+                dynarray_append(&ir->call_args, ir->values.dat[mark + i]);
+            }
+            ir->values.count = mark;
+
+            Item *item = find_item(n->scope, n->name_id);
+            assert(item && item->type == ITEM_FUNCTION);
+            StackData symbol_index = {};
+            symbol_index.u = item->id;
+            return ir_emit(ir, IR_CALL, first_arg, (u32)n->node_count, symbol_index);
+        } break;
+        case NODE_VARIABLE: {
+            Item *item = find_item(n->scope, n->name_id);
+            assert(item);
+
+            if (item->type == ITEM_GLOBALVARIABLE) {
+                StackData global_id = {};
+                global_id.u = item->id;
+                return ir_emit(ir, IR_GLOBAL, 0, 0, global_id);
+            } else if (item->type == ITEM_VARIABLE) {
+                return first + (u32)item->id;
+            } else {
+                assert(false && "unreachable");
+            }
         } break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
         case NODE_DIV: {
-            bytecode_from_tree2(inter, n->nodes[1]);
-            bytecode_from_tree2(inter, n->nodes[0]);
-            dynarray_append(&inter->bytecode, Bytecode {BYTECODE_DIV, {}});
+            u32 a = ir_from_tree2(inter, n->nodes[0], first);
+            u32 b = ir_from_tree2(inter, n->nodes[1], first);
+            IrOp op = IR_INVALID;
+            if (n->type == NODE_ADD) op = IR_ADD;
+            if (n->type == NODE_SUB) op = IR_SUB;
+            if (n->type == NODE_MUL) op = IR_MUL;
+            if (n->type == NODE_DIV) op = IR_DIV;
+            return ir_emit(ir, op, a, b, {});
         } break;
         case NODE_UNARYADD: {
-            bytecode_from_tree2(inter, n->nodes[0]);
+            return ir_from_tree2(inter, n->nodes[0], first);
         } break;
         case NODE_UNARYSUB: {
-            bytecode_from_tree2(inter, n->nodes[0]);
-            dynarray_append(&inter->bytecode, Bytecode {BYTECODE_NEG, {}});
+            u32 a = ir_from_tree2(inter, n->nodes[0], first);
+            return ir_emit(ir, IR_NEG, a, 0, {});
         } break;
-        case NODE_OPENPAREN: assert(false && "unreachable"); break;
+        case NODE_INVALID:
+        case NODE_PROGRAM:
+        case NODE_STATEMENT:
+        case NODE_FUNCTIONDEF:
+        case NODE_VARIABLEDEF:
+        case NODE_OPENPAREN:
         case NodeType_COUNT: assert(false && "unreachable"); break;
     }
+    return 0;
 }
 
-void bytecode_from_tree(Interpreter *inter) {
-    bytecode_from_tree2(inter, inter->ctx.root);
+// builds body as a function taking arg_count arguments, has to be called right after the
+// matching symbol was appended
+void ir_from_function(Interpreter *inter, Node *body, u64 arg_count) {
+    Ir *ir = &inter->ir;
+    f64 start = time_seconds();
+
+    IrFunction f = {};
+    f.first = (u32)ir->insts.count;
+    f.arg_count = (u32)arg_count;
+    for (u64 i = 0; i < arg_count; ++i) {
+        ir_emit(ir, IR_PARAM, (u32)i, 0, {});
+    }
+    f.result = ir_from_tree2(inter, body, f.first);
+    f.count = (u32)(ir->insts.count - f.first);
+    dynarray_append(&ir->functions, f);
+
+    // one run per function
+    IrPassStats *stats = ir->passes + IR_PASS_BUILD;
+    stats->seconds += time_seconds() - start;
+    stats->runs += 1;
+    stats->insts_after = ir->insts.count;
 }
 
-void print_bytecode(DynArray<Bytecode> *dynarray) {
-    for (u64 i = 0; i < dynarray->count; ++i) {
-        Bytecode *curr = dynarray->dat + i;
-        printf("%.*s, %f, %llu\n", (s32)str_BytecodeType[curr->type].count, str_BytecodeType[curr->type].dat, curr->imm.f, curr->imm.u);
+bool ir_is_binary(IrOp op) {
+    return op == IR_ADD || op == IR_SUB || op == IR_MUL || op == IR_DIV;
+}
+
+// starts a pass, the pass appends the new program to the next_ arrays and sets map[old value]
+void ir_rewrite_begin(Ir *ir) {
+    ir->next_insts.count = 0;
+    ir->next_call_args.count = 0;
+    ir->map.count = 0;
+    dynarray_reserve(&ir->map, ir->insts.count);
+    ir->map.count = ir->insts.count;
+}
+
+void ir_rewrite_end(Ir *ir) {
+    DynArray<IrInst> insts = ir->insts;
+    ir->insts = ir->next_insts;
+    ir->next_insts = insts;
+    DynArray<u32> call_args = ir->call_args;
+    ir->call_args = ir->next_call_args;
+    ir->next_call_args = call_args;
+}
+
+u32 ir_push(Ir *ir, IrInst inst) {
+    dynarray_append(&ir->next_insts, inst);
+    return (u32)(ir->next_insts.count - 1);
+}
+
+// old instruction with its operands mapped to new values, call arguments are appended to next_call_args
+IrInst ir_remap(Ir *ir, IrInst inst) {
+    if (inst.op == IR_NEG || ir_is_binary(inst.op)) {
+        inst.a = ir->map.dat[inst.a];
+        if (inst.op != IR_NEG) inst.b = ir->map.dat[inst.b];
+    } else if (inst.op == IR_CALL) {
+        u32 first_arg = (u32)ir->next_call_args.count;
+        for (u32 i = 0; i < inst.b; ++i) {
+            dynarray_append(&ir->next_call_args, ir->map.dat[ir->call_args.dat[inst.a + i]]);
+        }
+        inst.a = first_arg;
+    }
+    return inst;
+}
+
+// the instructions of f that are already in next_insts
+void ir_end_function(Ir *ir, IrFunction *f, u32 first) {
+    f->first = first;
+    f->count = (u32)(ir->next_insts.count - first);
+    f->result = ir->map.dat[f->result];
+}
+
+// callees this small without calls of their own are copied into the caller
+#define IR_INLINE_MAX_INSTS 32
+
+bool ir_is_inlinable(DynArray<IrInst> *insts, IrFunction *f) {
+    if (f->count - f->arg_count > IR_INLINE_MAX_INSTS) return false;
+    for (u32 i = f->first; i < f->first + f->count; ++i) {
+        if (insts->dat[i].op == IR_CALL) return false;
+    }
+    return true;
+}
+
+// functions before the current one are already inlined into, so they are copied from the
+// new program and a chain of small functions collapses bottom up
+void ir_inline(Ir *ir) {
+    ir_rewrite_begin(ir);
+    for (u64 fi = 0; fi < ir->functions.count; ++fi) {
+        IrFunction *f = ir->functions.dat + fi;
+        u32 first = (u32)ir->next_insts.count;
+        for (u32 i = f->first; i < f->first + f->count; ++i) {
+            IrInst inst = ir->insts.dat[i];
+            if (inst.op == IR_CALL) {
+                bool done = inst.imm.u < fi;
+                IrFunction callee = ir->functions.dat[inst.imm.u];
+                DynArray<IrInst> *callee_insts = done ? &ir->next_insts : &ir->insts;
+                if (ir_is_inlinable(callee_insts, &callee)) {
+                    // values of the callee by their index in it
+                    ir->values.count = 0;
+                    for (u32 k = 0; k < callee.count; ++k) {
+                        IrInst ci = callee_insts->dat[callee.first + k];
+                        u32 v = 0;
+                        if (ci.op == IR_PARAM) {
+                            v = ir->map.dat[ir->call_args.dat[inst.a + ci.a]];
+                        } else {
+                            if (ci.op == IR_NEG || ir_is_binary(ci.op)) {
+                                ci.a = ir->values.dat[ci.a - callee.first];
+                                if (ci.op != IR_NEG) ci.b = ir->values.dat[ci.b - callee.first];
+                            }
+                            v = ir_push(ir, ci);
+                        }
+                        dynarray_append(&ir->values, v);
+                    }
+                    ir->map.dat[i] = ir->values.dat[callee.result - callee.first];
+                    ir->values.count = 0;
+                    continue;
+                }
+            }
+            ir->map.dat[i] = ir_push(ir, ir_remap(ir, inst));
+        }
+        // f is written last since the callees above may be read from the old functions
+        IrFunction *out = ir->functions.dat + fi;
+        ir_end_function(ir, out, first);
+    }
+    ir_rewrite_end(ir);
+}
+
+bool ir_is_const(Ir *ir, u32 v, f64 value) {
+    IrInst *inst = ir->next_insts.dat + v;
+    if (inst->op != IR_CONST) return false;
+    // compares the bits so 0 and -0 are told apart
+    return memcmp(&inst->imm.f, &value, sizeof(f64)) == 0;
+}
+
+// folds operations on constants and the identities that hold for every double, the same ones fold_tree2 uses
+// except x*-1 which only matches -x up to the sign of a NaN
+u32 ir_fold(Ir *ir, IrInst inst) {
+    if (inst.op == IR_NEG) {
+        IrInst operand = ir->next_insts.dat[inst.a];
+        if (operand.op == IR_CONST) {
+            StackData sd = {};
+            sd.f = -operand.imm.f;
+            inst.op = IR_CONST;
+            inst.a = 0;
+            inst.imm = sd;
+        } else if (operand.op == IR_NEG) {
+            return operand.a;
+        }
+    } else if (ir_is_binary(inst.op)) {
+        IrInst lhs = ir->next_insts.dat[inst.a];
+        IrInst rhs = ir->next_insts.dat[inst.b];
+        if (lhs.op == IR_CONST && rhs.op == IR_CONST) {
+            StackData sd = {};
+            if (inst.op == IR_ADD) sd.f = lhs.imm.f + rhs.imm.f;
+            if (inst.op == IR_SUB) sd.f = lhs.imm.f - rhs.imm.f;
+            if (inst.op == IR_MUL) sd.f = lhs.imm.f * rhs.imm.f;
+            if (inst.op == IR_DIV) sd.f = lhs.imm.f / rhs.imm.f;
+            inst.op = IR_CONST;
+            inst.a = 0;
+            inst.b = 0;
+            inst.imm = sd;
+        } else if (inst.op == IR_ADD) {
+            if (ir_is_const(ir, inst.b, -0.0)) return inst.a;
+            if (ir_is_const(ir, inst.a, -0.0)) return inst.b;
+        } else if (inst.op == IR_SUB) {
+            if (ir_is_const(ir, inst.b, 0.0)) return inst.a;
+        } else if (inst.op == IR_MUL) {
+            if (ir_is_const(ir, inst.b, 1.0)) return inst.a;
+            if (ir_is_const(ir, inst.a, 1.0)) return inst.b;
+        } else if (inst.op == IR_DIV) {
+            if (ir_is_const(ir, inst.b, 1.0)) return inst.a;
+        }
+    }
+    return ir_push(ir, inst);
+}
+
+void ir_constprop(Ir *ir) {
+    ir_rewrite_begin(ir);
+    for (u64 fi = 0; fi < ir->functions.count; ++fi) {
+        IrFunction *f = ir->functions.dat + fi;
+        u32 first = (u32)ir->next_insts.count;
+        for (u32 i = f->first; i < f->first + f->count; ++i) {
+            ir->map.dat[i] = ir_fold(ir, ir_remap(ir, ir->insts.dat[i]));
+        }
+        ir_end_function(ir, f, first);
+    }
+    ir_rewrite_end(ir);
+}
+
+u64 ir_hash(Ir *ir, IrInst *inst) {
+    u64 h = (u64)inst->op * 0x9E3779B97F4A7C15ull;
+    h = (h ^ inst->a) * 0x100000001B3ull;
+    h = (h ^ inst->b) * 0x100000001B3ull;
+    h = (h ^ inst->imm.u) * 0x100000001B3ull;
+    if (inst->op == IR_CALL) {
+        for (u32 i = 0; i < inst->b; ++i) {
+            h = (h ^ ir->next_call_args.dat[inst->a + i]) * 0x100000001B3ull;
+        }
+    }
+    return h ^ (h >> 29);
+}
+
+bool ir_equal(Ir *ir, IrInst *x, IrInst *y) {
+    if (x->op != y->op || x->b != y->b || x->imm.u != y->imm.u) return false;
+    if (x->op != IR_CALL) return x->a == y->a;
+    for (u32 i = 0; i < x->b; ++i) {
+        if (ir->next_call_args.dat[x->a + i] != ir->next_call_args.dat[y->a + i]) return false;
+    }
+    return true;
+}
+
+// every value is computed once per function, calls included since functions have no side effects.
+// Operands are never swapped, a + b and b + a can differ in the payload of a NaN
+void ir_cse(Ir *ir) {
+    ir_rewrite_begin(ir);
+    for (u64 fi = 0; fi < ir->functions.count; ++fi) {
+        IrFunction *f = ir->functions.dat + fi;
+        u32 first = (u32)ir->next_insts.count;
+
+        // new value + 1 open addressed on ir_hash, 0 is empty
+        u64 cap = next_power_of_two((u64)f->count * 2 + 16);
+        ir->table.count = 0;
+        dynarray_reserve(&ir->table, cap);
+        ir->table.count = cap;
+        memset(ir->table.dat, 0, cap * sizeof(u32));
+
+        for (u32 i = f->first; i < f->first + f->count; ++i) {
+            u64 args_mark = ir->next_call_args.count;
+            IrInst inst = ir_remap(ir, ir->insts.dat[i]);
+            // parameters stay at the start of the function
+            if (inst.op == IR_PARAM) {
+                ir->map.dat[i] = ir_push(ir, inst);
+                continue;
+            }
+            u64 slot = ir_hash(ir, &inst) & (cap - 1);
+            while (ir->table.dat[slot] != 0 && !ir_equal(ir, &inst, ir->next_insts.dat + ir->table.dat[slot] - 1)) {
+                slot = (slot + 1) & (cap - 1);
+            }
+            if (ir->table.dat[slot] != 0) {
+                ir->next_call_args.count = args_mark;
+                ir->map.dat[i] = ir->table.dat[slot] - 1;
+            } else {
+                ir->map.dat[i] = ir_push(ir, inst);
+                ir->table.dat[slot] = ir->map.dat[i] + 1;
+            }
+        }
+        ir_end_function(ir, f, first);
+    }
+    ir_rewrite_end(ir);
+}
+
+// drops values nothing reads. Parameters are kept so they stay at the start and calls since
+// a call that recurses forever is an error the other vms report
+void ir_dce(Ir *ir) {
+    ir_rewrite_begin(ir);
+    for (u64 fi = 0; fi < ir->functions.count; ++fi) {
+        IrFunction *f = ir->functions.dat + fi;
+        u32 first = (u32)ir->next_insts.count;
+
+        // live flags by index in the function, operands always come before their users
+        ir->values.count = 0;
+        dynarray_reserve(&ir->values, f->count);
+        ir->values.count = f->count;
+        memset(ir->values.dat, 0, f->count * sizeof(u32));
+        ir->values.dat[f->result - f->first] = 1;
+        for (u32 i = f->first + f->count; i-- > f->first;) {
+            IrInst *inst = ir->insts.dat + i;
+            if (inst->op == IR_PARAM || inst->op == IR_CALL) ir->values.dat[i - f->first] = 1;
+            if (!ir->values.dat[i - f->first]) continue;
+            if (inst->op == IR_NEG || ir_is_binary(inst->op)) {
+                ir->values.dat[inst->a - f->first] = 1;
+                if (inst->op != IR_NEG) ir->values.dat[inst->b - f->first] = 1;
+            } else if (inst->op == IR_CALL) {
+                for (u32 k = 0; k < inst->b; ++k) {
+                    ir->values.dat[ir->call_args.dat[inst->a + k] - f->first] = 1;
+                }
+            }
+        }
+
+        for (u32 i = f->first; i < f->first + f->count; ++i) {
+            if (!ir->values.dat[i - f->first]) continue;
+            ir->map.dat[i] = ir_push(ir, ir_remap(ir, ir->insts.dat[i]));
+        }
+        ir_end_function(ir, f, first);
+    }
+    ir->values.count = 0;
+    ir_rewrite_end(ir);
+}
+
+typedef void (*IrPassProc)(Ir *ir);
+
+void ir_run_pass(Ir *ir, IrPass pass, IrPassProc proc) {
+    IrPassStats *stats = ir->passes + pass;
+    stats->insts_before = ir->insts.count;
+    f64 start = time_seconds();
+    proc(ir);
+    stats->seconds += time_seconds() - start;
+    stats->runs += 1;
+    stats->insts_after = ir->insts.count;
+}
+
+// each round inlines one more level of calls and cleans up after it
+#define IR_OPTIMIZE_ROUNDS 2
+
+void ir_optimize(Ir *ir) {
+    for (u32 round = 0; round < IR_OPTIMIZE_ROUNDS; ++round) {
+        ir_run_pass(ir, IR_PASS_INLINE, ir_inline);
+        ir_run_pass(ir, IR_PASS_CONSTPROP, ir_constprop);
+        ir_run_pass(ir, IR_PASS_CSE, ir_cse);
+        ir_run_pass(ir, IR_PASS_DCE, ir_dce);
+    }
+}
+
+// registers in use are nonzero, the lowest free one is taken
+u32 reg_alloc(DynArray<u32> *used) {
+    for (u32 r = 0; r < used->count; ++r) {
+        if (used->dat[r] == 0) {
+            used->dat[r] = 1;
+            return r;
+        }
+    }
+    dynarray_append(used, 1u);
+    return (u32)(used->count - 1);
+}
+
+// one past the highest register in use
+u32 reg_top(DynArray<u32> *used) {
+    while (used->count > 0 && used->dat[used->count - 1] == 0) used->count -= 1;
+    return (u32)used->count;
+}
+
+// register code of every function in symbol order. A call needs its arguments in consecutive
+// registers above everything still live since the callee frame starts at the first argument
+void reg_bytecode_from_ir(Interpreter *inter) {
+    Ir *ir = &inter->ir;
+    Program *program = &inter->program;
+    f64 start = time_seconds();
+
+    DynArray<u32> *last_use = &ir->map;
+    DynArray<u32> *regs = &ir->values;
+    DynArray<u32> *used = &ir->table;
+    for (u64 fi = 0; fi < ir->functions.count; ++fi) {
+        IrFunction *f = ir->functions.dat + fi;
+        dynarray_append(&program->reg_symbol_ids, program->reg_bytecode.count);
+
+        // by index in the function, a value nothing reads dies where it is defined
+        last_use->count = 0;
+        dynarray_reserve(last_use, f->count);
+        last_use->count = f->count;
+        regs->count = 0;
+        dynarray_reserve(regs, f->count);
+        regs->count = f->count;
+        for (u32 i = 0; i < f->count; ++i) {
+            last_use->dat[i] = i;
+            IrInst *inst = ir->insts.dat + f->first + i;
+            if (inst->op == IR_NEG || ir_is_binary(inst->op)) {
+                last_use->dat[inst->a - f->first] = i;
+                if (inst->op != IR_NEG) last_use->dat[inst->b - f->first] = i;
+            } else if (inst->op == IR_CALL) {
+                for (u32 k = 0; k < inst->b; ++k) {
+                    last_use->dat[ir->call_args.dat[inst->a + k] - f->first] = i;
+                }
+            }
+        }
+        last_use->dat[f->result - f->first] = f->count;
+
+        // parameters keep registers 0..arg_count - 1 for the whole function
+        used->count = 0;
+        for (u32 i = 0; i < f->arg_count; ++i) {
+            regs->dat[i] = i;
+            dynarray_append(used, 1u);
+        }
+        u32 frame_size = f->arg_count > 0 ? f->arg_count : 1;
+
+        for (u32 i = f->arg_count; i < f->count; ++i) {
+            IrInst *inst = ir->insts.dat + f->first + i;
+            u32 dst = 0;
+            switch (inst->op) {
+                case IR_CONST: {
+                    dst = reg_alloc(used);
+                    reg_emit(inter, REG_BYTECODE_LOADK, dst, 0, 0, inst->imm);
+                } break;
+                case IR_GLOBAL: {
+                    dst = reg_alloc(used);
+                    reg_emit(inter, REG_BYTECODE_LOAD_GLOBAL, dst, 0, 0, inst->imm);
+                } break;
+                case IR_NEG:
+                case IR_ADD:
+                case IR_SUB:
+                case IR_MUL:
+                case IR_DIV: {
+                    u32 a = inst->a - f->first;
+                    u32 b = inst->op == IR_NEG ? a : inst->b - f->first;
+                    // operands read here for the last time can hold the result
+                    if (last_use->dat[a] == i && a >= f->arg_count) used->dat[regs->dat[a]] = 0;
+                    if (last_use->dat[b] == i && b >= f->arg_count) used->dat[regs->dat[b]] = 0;
+                    dst = reg_alloc(used);
+
+                    RegBytecodeType type = REG_BYTECODE_NEG;
+                    if (inst->op == IR_ADD) type = REG_BYTECODE_ADD;
+                    if (inst->op == IR_SUB) type = REG_BYTECODE_SUB;
+                    if (inst->op == IR_MUL) type = REG_BYTECODE_MUL;
+                    if (inst->op == IR_DIV) type = REG_BYTECODE_DIV;
+                    reg_emit(inter, type, dst, regs->dat[a], regs->dat[b], {});
+                } break;
+                case IR_CALL: {
+                    u32 *args = ir->call_args.dat + inst->a;
+                    for (u32 k = 0; k < inst->b; ++k) {
+                        u32 v = args[k] - f->first;
+                        if (last_use->dat[v] == i && v >= f->arg_count) used->dat[regs->dat[v]] = 0;
+                    }
+                    u32 live_top = reg_top(used);
+
+                    // arguments computed in order usually already sit at the top
+                    bool in_place = inst->b > 0;
+                    u32 arg_base = inst->b > 0 ? regs->dat[args[0] - f->first] : live_top;
+                    for (u32 k = 0; k < inst->b; ++k) {
+                        u32 v = args[k] - f->first;
+                        if (regs->dat[v] != arg_base + k || last_use->dat[v] != i || arg_base < live_top) in_place = false;
+                    }
+                    if (!in_place) {
+                        // above every source so no move overwrites an argument not moved yet
+                        arg_base = live_top;
+                        for (u32 k = 0; k < inst->b; ++k) {
+                            u32 r = regs->dat[args[k] - f->first];
+                            if (r + 1 > arg_base) arg_base = r + 1;
+                        }
+                        for (u32 k = 0; k < inst->b; ++k) {
+                            reg_emit(inter, REG_BYTECODE_MOVE, arg_base + k, regs->dat[args[k] - f->first], 0, {});
+                        }
+                    }
+
+                    // address and frame size of the callee are filled in by bytecode_from_tree
+                    reg_emit(inter, REG_BYTECODE_CALL, arg_base, inst->b, 0, inst->imm);
+                    u32 callee_size = arg_base + (inst->b > 0 ? inst->b : 1);
+                    if (callee_size > frame_size) frame_size = callee_size;
+                    while (used->count <= arg_base) dynarray_append(used, 0u);
+                    used->dat[arg_base] = 1;
+                    dst = arg_base;
+                } break;
+                case IR_INVALID:
+                case IR_PARAM:
+                case IrOp_COUNT: assert(false && "unreachable"); break;
+            }
+            regs->dat[i] = dst;
+            if (dst + 1 > frame_size) frame_size = dst + 1;
+            if (last_use->dat[i] == i) used->dat[dst] = 0;
+        }
+
+        reg_emit(inter, REG_BYTECODE_RETURN, 0, regs->dat[f->result - f->first], 0, {});
+        dynarray_append(&program->reg_frame_sizes, (u64)frame_size);
+    }
+    regs->count = 0;
+
+    IrPassStats *stats = ir->passes + IR_PASS_LOWER;
+    stats->seconds += time_seconds() - start;
+    stats->runs += 1;
+    stats->insts_before = ir->insts.count;
+    stats->insts_after = program->reg_bytecode.count;
+}
+
+void print_ir(Ir *ir, Program *program) {
+    for (u64 fi = 0; fi < ir->functions.count; ++fi) {
+        IrFunction *f = ir->functions.dat + fi;
+        String name = program->symbols.dat[fi];
+        printf("%.*s, %u args\n", (s32)name.count, name.dat, f->arg_count);
+        // values are numbered within the function, v0.. are the parameters
+        for (u32 i = f->arg_count; i < f->count; ++i) {
+            IrInst *inst = ir->insts.dat + f->first + i;
+            String op = str_IrOp[inst->op];
+            printf("    v%u = %.*s", i, (s32)op.count, op.dat);
+            if (inst->op == IR_CONST) {
+                printf(" %g", inst->imm.f);
+            } else if (inst->op == IR_GLOBAL) {
+                printf(" %llu", inst->imm.u);
+            } else if (inst->op == IR_CALL) {
+                String callee = program->symbols.dat[inst->imm.u];
+                printf(" %.*s(", (s32)callee.count, callee.dat);
+                for (u32 k = 0; k < inst->b; ++k) {
+                    printf(k == 0 ? "v%u" : ", v%u", ir->call_args.dat[inst->a + k] - f->first);
+                }
+                printf(")");
+            } else if (inst->op == IR_NEG) {
+                printf(" v%u", inst->a - f->first);
+            } else {
+                printf(" v%u, v%u", inst->a - f->first, inst->b - f->first);
+            }
+            printf("\n");
+        }
+        printf("    return v%u\n", f->result - f->first);
+    }
+}
+
+void print_ir_passes(Ir *ir) {
+    for (u64 i = 0; i < IrPass_COUNT; ++i) {
+        IrPassStats *stats = ir->passes + i;
+        printf("%.*s: %llu runs, %.3f ms, %llu -> %llu\n", (s32)str_IrPass[i].count, str_IrPass[i].dat,
+            stats->runs, stats->seconds * 1000, stats->insts_before, stats->insts_after);
+    }
+}
+
+void bytecode_from_tree2(Interpreter *inter, Node *n);
+
+// returns of up to 3 arguments have them in the opcode, the rest in imm
+BytecodeType return_type(u64 arg_count) {
+    if (arg_count <= 3) return (BytecodeType)(BYTECODE_RETURN0 + arg_count);
+    return BYTECODE_RETURN;
+}
+
+bool is_return(BytecodeType type) {
+    return type == BYTECODE_RETURN || (type >= BYTECODE_RETURN0 && type <= BYTECODE_RETURN3);
+}
+
+u64 return_arg_count(Bytecode *code) {
+    if (code->type == BYTECODE_RETURN) return code->imm.u;
+    return (u64)(code->type - BYTECODE_RETURN0);
+}
+
+void clear_locals(Node *n) {
+    n->cse_local = 0;
+    for (u64 i = 0; i < n->node_count; ++i) {
+        clear_locals(n->nodes[i]);
+    }
+}
+
+// shared nodes are computed at the start of the function, the ones they contain first, and
+// stay on the stack above the frame as its locals
+void bytecode_locals(Interpreter *inter, Node *n, u32 *local_count) {
+    if (n->cse_local != 0) return;
+    for (u64 i = 0; i < n->node_count; ++i) {
+        bytecode_locals(inter, n->nodes[i], local_count);
+    }
+    // a leaf is as cheap to push again
+    if (n->cse_uses > 1 && n->node_count > 0) {
+        bytecode_from_tree2(inter, n);
+        *local_count += 1;
+        n->cse_local = *local_count;
+    }
+}
+
+// instructions emitted since the last call belong to n, its children map theirs before it does
+void map_source(Interpreter *inter, Node *n) {
+    Program *program = &inter->program;
+    while (program->source_map.count < program->bytecode.count) dynarray_append(&program->source_map, n);
+}
+
+void bytecode_from_body(Interpreter *inter, Node *body) {
+    clear_locals(body);
+    u32 local_count = 0;
+    bytecode_locals(inter, body, &local_count);
+    bytecode_from_tree2(inter, body);
+}
+
+void bytecode_from_tree2(Interpreter *inter, Node *n) {
+    if (n->cse_local != 0) {
+        StackData local = {};
+        local.u = n->cse_local - 1;
+        dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_PUSH_LOCAL, local});
+        map_source(inter, n);
+        return;
+    }
+    switch (n->type) {
+        case NODE_INVALID: assert(false && "unreachable"); break;
+        case NODE_PROGRAM: {
+            for (u64 i = 0; i < n->node_count; ++i) {
+                bytecode_from_tree2(inter, n->nodes[i]);
+            }
+
+        } break;
+        case NODE_STATEMENT: {
+            assert(n->node_count == 1);
+            bool def = n->nodes[0]->type == NODE_FUNCTIONDEF || n->nodes[0]->type == NODE_VARIABLEDEF;
+            if (!def) {
+                String s = string_printf(&inter->func_arena, "_s%llu", inter->program.symbols.count);
+                add_symbol(&inter->program, s, 0);
+                bytecode_from_body(inter, n->nodes[0]);
+            } else {
+                bytecode_from_tree2(inter, n->nodes[0]);
+            }
+            if (!def) {
+                StackData sd = {};
+                sd.u = 0;
+                dynarray_append(&inter->program.bytecode, {BYTECODE_RETURN0, sd});
+                ir_from_function(inter, n->nodes[0], 0);
+            }
+        } break;
+        case NODE_NUMBER: {
+            StackData sd = {};
+            sd.f = n->number;
+
+            dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_PUSH, sd});
+        } break;
+        case NODE_FUNCTION: {
+            for (u64 i = n->node_count; i-- > 0;) {
+                bytecode_from_tree2(inter, n->nodes[i]);
+            }
+            Item *item = find_item(n->scope, n->name_id);
+            assert(item && item->type == ITEM_FUNCTION);
+
+            // the callee can be defined later, its address is filled in by bytecode_from_tree
+            StackData symbol_index = {};
+            symbol_index.u = item->id;
+            dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_CALL, symbol_index});
+        } break;
+        case NODE_FUNCTIONDEF: {
+            String name = n->text;
+            add_symbol(&inter->program, name, n->node_count - 1);
+
+            bytecode_from_body(inter, n->nodes[n->node_count - 1]);
+            StackData num_args = {};
+            num_args.u = n->node_count - 1;
+            dynarray_append(&inter->program.bytecode, Bytecode {return_type(num_args.u), num_args});
+            ir_from_function(inter, n->nodes[n->node_count - 1], num_args.u);
+        } break;
+        case NODE_VARIABLE: {
+            Item *item = find_item(n->scope, n->name_id);
+            assert(item);
+
+            if (item->type == ITEM_GLOBALVARIABLE) {
+                StackData global_id = {};
+                global_id.u = item->id;
+                dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_PUSH_GLOBAL, global_id});
+
+            } else if (item->type == ITEM_VARIABLE) {
+                StackData sd = {};
+                sd.u = item->id;
+                dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_PUSH_ARG, sd});
+            } else {
+                assert(false && "unreachable");
+            }
+
+        } break;
+        case NODE_VARIABLEDEF: {
+            String name = n->text;
+            add_symbol(&inter->program, name, 0);
+
+            assert(n->node_count == 1);
+            bytecode_from_body(inter, n->nodes[0]);
+            dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_RETURN0, {}});
+            ir_from_function(inter, n->nodes[0], 0);
+        } break;
+        case NODE_ADD: {
+            bytecode_from_tree2(inter, n->nodes[1]);
+            bytecode_from_tree2(inter, n->nodes[0]);
+            dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_ADD, {}});
+        } break;
+        case NODE_SUB: {
+            bytecode_from_tree2(inter, n->nodes[1]);
+            bytecode_from_tree2(inter, n->nodes[0]);
+            dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_SUB, {}});
+        } break;
+        case NODE_MUL: {
+            bytecode_from_tree2(inter, n->nodes[1]);
+            bytecode_from_tree2(inter, n->nodes[0]);
+            dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_MUL, {}});
+        } break;
+        case NODE_DIV: {
+            bytecode_from_tree2(inter, n->nodes[1]);
+            bytecode_from_tree2(inter, n->nodes[0]);
+            dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_DIV, {}});
+        } break;
+        case NODE_UNARYADD: {
+            bytecode_from_tree2(inter, n->nodes[0]);
+        } break;
+        case NODE_UNARYSUB: {
+            bytecode_from_tree2(inter, n->nodes[0]);
+            dynarray_append(&inter->program.bytecode, Bytecode {BYTECODE_NEG, {}});
+        } break;
+        case NODE_OPENPAREN: assert(false && "unreachable"); break;
+        case NodeType_COUNT: assert(false && "unreachable"); break;
+    }
+    map_source(inter, n);
+}
+
+bool is_binary(BytecodeType type) {
+    return type >= BYTECODE_ADD && type <= BYTECODE_DIV;
+}
+
+// op pairs without an operand left after the fusions above. MUL ADD is a multiply-add
+struct FusedPair {
+    BytecodeType first;
+    BytecodeType second;
+    BytecodeType fused;
+};
+
+FusedPair fused_pairs[] = {
+    {BYTECODE_ADD, BYTECODE_ADD, BYTECODE_ADDADD},
+    {BYTECODE_MUL, BYTECODE_ADD, BYTECODE_MULADD},
+};
+
+// the op that pops the number pushed at i as its rhs, or as the lhs of an ADD or MUL right after
+// it, 0 when something else pops it. Calls still have the symbol index of the callee
+u64 op_of_push(Program *program, u64 i) {
+    DynArray<Bytecode> *code = &program->bytecode;
+    // values on the stack from the pushed number up
+    u64 depth = 1;
+    for (u64 j = i + 1; j < code->count; ++j) {
+        Bytecode *b = code->dat + j;
+        u64 pops = 0;
+        switch (b->type) {
+            case BYTECODE_CALL: pops = program->symbol_arg_counts.dat[b->imm.u]; break;
+            case BYTECODE_PUSH_ARG:
+            case BYTECODE_PUSH_LOCAL:
+            case BYTECODE_PUSH:
+            case BYTECODE_PUSH_GLOBAL: break;
+            case BYTECODE_NEG:
+            case BYTECODE_ADD_CONST:
+            case BYTECODE_SUB_CONST:
+            case BYTECODE_MUL_CONST:
+            case BYTECODE_DIV_CONST: pops = 1; break;
+            case BYTECODE_ADD:
+            case BYTECODE_SUB:
+            case BYTECODE_MUL:
+            case BYTECODE_DIV: {
+                if (depth == 2) return j;
+                if (depth == 1 && (b->type == BYTECODE_ADD || b->type == BYTECODE_MUL)) return j;
+                pops = 2;
+            } break;
+            // the end of the function, the rest is only made by peephole_bytecode
+            case BYTECODE_RETURN:
+            case BYTECODE_RETURN0:
+            case BYTECODE_RETURN1:
+            case BYTECODE_RETURN2:
+            case BYTECODE_RETURN3:
+            case BYTECODE_ADD_ARG:
+            case BYTECODE_SUB_ARG:
+            case BYTECODE_MUL_ARG:
+            case BYTECODE_DIV_ARG:
+            case BYTECODE_MULADD:
+            case BYTECODE_ADDADD:
+            case BYTECODE_INVALID:
+            case BytecodeType_COUNT: return 0;
+        }
+        if (pops >= depth) return 0;
+        depth = depth - pops + 1;
+    }
+    return 0;
+}
+
+// drops the instructions marked in removed. Nothing jumps into the middle of a function so only
+// the starts in symbol_ids move
+void remove_bytecode(Program *program, bool *removed) {
+    u64 count = program->bytecode.count;
+    u64 *moved = (u64 *)calloc(count + 1, sizeof(u64));
+    assert(moved);
+    u64 out = 0;
+    for (u64 i = 0; i < count; ++i) {
+        moved[i] = out;
+        if (removed[i]) continue;
+        program->bytecode.dat[out] = program->bytecode.dat[i];
+        program->source_map.dat[out] = program->source_map.dat[i];
+        out += 1;
+    }
+    moved[count] = out;
+    program->bytecode.count = out;
+    program->source_map.count = out;
+
+    for (u64 i = 0; i < program->symbol_ids.count; ++i) {
+        program->symbol_ids.dat[i] = moved[program->symbol_ids.dat[i]];
+    }
+    free(moved);
+}
+
+// a pushed number goes into the imm of the op that pops it, which has it as the rhs. Then a push
+// of an argument followed by a binary op becomes one instruction with the argument as the lhs,
+// the pairs in fused_pairs become their fused op and NEG NEG goes away. A fused instruction maps
+// to the source of the last op. bytecode_pairs counts the pairs that are left
+void peephole_bytecode(Interpreter *inter) {
+    Program *program = &inter->program;
+    DynArray<Bytecode> *code = &program->bytecode;
+    assert(program->source_map.count == code->count);
+    bool *removed = (bool *)calloc(code->count + 1, sizeof(bool));
+    assert(removed);
+
+    for (u64 i = 0; i < code->count; ++i) {
+        if (code->dat[i].type != BYTECODE_PUSH) continue;
+        u64 op = op_of_push(program, i);
+        if (op == 0) continue;
+        code->dat[op] = Bytecode {(BytecodeType)(BYTECODE_ADD_CONST + (code->dat[op].type - BYTECODE_ADD)), code->dat[i].imm};
+        removed[i] = true;
+    }
+    remove_bytecode(program, removed);
+
+    memset(removed, 0, code->count * sizeof(bool));
+    for (u64 i = 0; i + 1 < code->count; ++i) {
+        Bytecode *curr = code->dat + i;
+        Bytecode *next = code->dat + i + 1;
+        if (curr->type == BYTECODE_PUSH_ARG && is_binary(next->type)) {
+            *next = Bytecode {(BytecodeType)(BYTECODE_ADD_ARG + (next->type - BYTECODE_ADD)), curr->imm};
+            removed[i] = true;
+        } else if (curr->type == BYTECODE_NEG && next->type == BYTECODE_NEG) {
+            removed[i] = true;
+            removed[i + 1] = true;
+            i += 1;
+        } else {
+            for (u64 f = 0; f < ARRAY_SIZE(fused_pairs); ++f) {
+                if (curr->type != fused_pairs[f].first || next->type != fused_pairs[f].second) continue;
+                *next = Bytecode {fused_pairs[f].fused, {}};
+                removed[i] = true;
+            }
+        }
+    }
+    remove_bytecode(program, removed);
+    free(removed);
+
+    for (u64 i = 1; i < code->count; ++i) {
+        inter->bytecode_pairs[code->dat[i - 1].type][code->dat[i].type] += 1;
+    }
+}
+
+// most frequent first, ties in opcode order
+void print_bytecode_pairs(Interpreter *inter, u64 top) {
+    u64 *pairs = &inter->bytecode_pairs[0][0];
+    u64 pair_count = BytecodeType_COUNT * BytecodeType_COUNT;
+    u64 last = pair_count;
+    for (u64 n = 0; n < top; ++n) {
+        u64 best = pair_count;
+        for (u64 p = 0; p < pair_count; ++p) {
+            if (pairs[p] == 0) continue;
+            // after last in the order
+            if (last < pair_count && (pairs[p] > pairs[last] || (pairs[p] == pairs[last] && p <= last))) continue;
+            if (best == pair_count || pairs[p] > pairs[best]) best = p;
+        }
+        if (best == pair_count) break;
+        last = best;
+        u64 a = best / BytecodeType_COUNT;
+        u64 b = best % BytecodeType_COUNT;
+        printf("%.*s %.*s: %llu\n", (s32)str_BytecodeType[a].count, str_BytecodeType[a].dat,
+            (s32)str_BytecodeType[b].count, str_BytecodeType[b].dat, pairs[best]);
+    }
+}
+
+void build_threaded_code(Program *program);
+void compact_program(Program *program);
+void jit_program(Program *program);
+
+// walks each function once counting the values above its base. Rejects code that pops below
+// the base, calls anything but the start of a function with its arity, reads an argument,
+// local or global that is not there or does not end in exactly one return of its own arity.
+// What it proves lets the vms reserve the stack once per call and push and pop unchecked
+bool verify_bytecode(Interpreter *inter) {
+    Program *program = &inter->program;
+    program->stack_depths.count = 0;
+    program->max_stack_depth = 0;
+
+    // symbol index + 1 of the function starting at each instruction
+    u64 *callees = (u64 *)calloc(program->bytecode.count + 1, sizeof(*callees));
+    u64 bad_symbol = FUNCTION_HANDLE_INVALID;
+    for (u64 s = 0; s < program->symbols.count; ++s) {
+        u64 start = program->symbol_ids.dat[s];
+        u64 end = s + 1 < program->symbols.count ? program->symbol_ids.dat[s + 1] : program->bytecode.count;
+        if (start >= end || end > program->bytecode.count) {
+            bad_symbol = s;
+            break;
+        }
+        callees[start] = s + 1;
+    }
+
+    for (u64 s = 0; s < program->symbols.count && bad_symbol == FUNCTION_HANDLE_INVALID; ++s) {
+        u64 start = program->symbol_ids.dat[s];
+        u64 end = s + 1 < program->symbols.count ? program->symbol_ids.dat[s + 1] : program->bytecode.count;
+        u64 arg_count = program->symbol_arg_counts.dat[s];
+        u64 depth = 0;
+        u64 max_depth = 0;
+        bool ok = true;
+        bool returned = false;
+        for (u64 i = start; i < end && ok; ++i) {
+            Bytecode *code = program->bytecode.dat + i;
+            u64 pops = 0;
+            u64 pushes = 1;
+            switch (code->type) {
+                case BYTECODE_INVALID: ok = false; break;
+                case BYTECODE_CALL: {
+                    u64 callee = code->imm.u < program->bytecode.count ? callees[code->imm.u] : 0;
+                    if (callee == 0) ok = false;
+                    else pops = program->symbol_arg_counts.dat[callee - 1];
+                } break;
+                case BYTECODE_RETURN:
+                case BYTECODE_RETURN0:
+                case BYTECODE_RETURN1:
+                case BYTECODE_RETURN2:
+                case BYTECODE_RETURN3: {
+                    // the result has to be on top and nothing can follow
+                    ok = return_arg_count(code) == arg_count && i + 1 == end;
+                    pops = 1;
+                    returned = true;
+                } break;
+                case BYTECODE_PUSH_ARG: ok = code->imm.u < arg_count; break;
+                case BYTECODE_PUSH_LOCAL: ok = code->imm.u < depth; break;
+                case BYTECODE_PUSH: break;
+                case BYTECODE_PUSH_GLOBAL: ok = code->imm.u < inter->global_statements.count; break;
+                case BYTECODE_NEG: pops = 1; break;
+                case BYTECODE_ADD:
+                case BYTECODE_SUB:
+                case BYTECODE_MUL:
+                case BYTECODE_DIV: pops = 2; break;
+                case BYTECODE_ADD_ARG:
+                case BYTECODE_SUB_ARG:
+                case BYTECODE_MUL_ARG:
+                case BYTECODE_DIV_ARG: {
+                    ok = code->imm.u < arg_count;
+                    pops = 1;
+                } break;
+                case BYTECODE_ADD_CONST:
+                case BYTECODE_SUB_CONST:
+                case BYTECODE_MUL_CONST:
+                case BYTECODE_DIV_CONST: pops = 1; break;
+                case BYTECODE_MULADD:
+                case BYTECODE_ADDADD: pops = 3; break;
+                case BytecodeType_COUNT: ok = false; break;
+            }
+            if (!ok || pops > depth) {
+                ok = false;
+                break;
+            }
+            depth = depth - pops + pushes;
+            if (depth > max_depth) max_depth = depth;
+        }
+        if (!ok || !returned) {
+            bad_symbol = s;
+            break;
+        }
+        dynarray_append(&program->stack_depths, max_depth);
+        if (max_depth > program->max_stack_depth) program->max_stack_depth = max_depth;
+    }
+    free(callees);
+
+    if (bad_symbol == FUNCTION_HANDLE_INVALID) return true;
+    Error err = {};
+    err.has_statement = true;
+    err.statement_id = bad_symbol;
+    err.err_string = str_lit("Malformed bytecode");
+    dynarray_append(&inter->errors, err);
+    return false;
+}
+
+void bytecode_from_tree(Interpreter *inter) {
+    Program *program = &inter->program;
+    // every statement adds one symbol
+    SymbolMap *map = &program->symbol_map;
+    map->cap = next_power_of_two(inter->ctx.root->node_count * 2 + 16);
+    map->slots = (u64 *)arena_alloc(&inter->func_arena, map->cap * sizeof(*map->slots));
+    bytecode_from_tree2(inter, inter->ctx.root);
+    peephole_bytecode(inter);
+    ir_optimize(&inter->ir);
+    reg_bytecode_from_ir(inter);
+
+    // calls were emitted with the symbol index of the callee, the symbol index of a function is its statement index
+    for (u64 i = 0; i < program->bytecode.count; ++i) {
+        Bytecode *code = program->bytecode.dat + i;
+        if (code->type == BYTECODE_CALL) code->imm.u = program->symbol_ids.dat[code->imm.u];
+    }
+    for (u64 i = 0; i < program->reg_bytecode.count; ++i) {
+        RegBytecode *code = program->reg_bytecode.dat + i;
+        if (code->type != REG_BYTECODE_CALL) continue;
+        u64 symbol_index = code->imm.u;
+        code->imm.u = program->reg_symbol_ids.dat[symbol_index];
+        code->b = (u32)program->reg_frame_sizes.dat[symbol_index];
+    }
+
+    if (!verify_bytecode(inter)) return;
+
+    build_threaded_code(program);
+    compact_program(program);
+    jit_program(program);
+}
+
+void print_bytecode(DynArray<Bytecode> *dynarray) {
+    for (u64 i = 0; i < dynarray->count; ++i) {
+        Bytecode *curr = dynarray->dat + i;
+        printf("%.*s, %f, %llu\n", (s32)str_BytecodeType[curr->type].count, str_BytecodeType[curr->type].dat, curr->imm.f, curr->imm.u);
+    }
+}
+
+
+void print_reg_bytecode(DynArray<RegBytecode> *dynarray) {
+    for (u64 i = 0; i < dynarray->count; ++i) {
+        RegBytecode *curr = dynarray->dat + i;
+        printf("%.*s, r%u, r%u, r%u, %f, %llu\n", (s32)str_RegBytecodeType[curr->type].count, str_RegBytecodeType[curr->type].dat, curr->dst, curr->a, curr->b, curr->imm.f, curr->imm.u);
+    }
+}
+
+#define ENTRY_RETURN_ADDRESS (~0ull)
+// deeper than any chain of definitions, without conditionals only recursion gets there
+#define MAX_CALL_DEPTH (1 << 16)
+// instructions between checks of the clock and of ExecutionContext::cancel
+#define EXECUTE_SLICE_INSTRUCTIONS (1 << 16)
+
+bool is_cancelled(Interpreter *inter) {
+    return inter->cancel && atomic_load(inter->cancel) != 0;
+}
+
+u64 call_depth_limit(ExecutionContext *ctx) {
+    if (ctx->max_call_depth == 0 || ctx->max_call_depth > MAX_CALL_DEPTH) return MAX_CALL_DEPTH;
+    return ctx->max_call_depth;
+}
+
+void set_stack_overflow_error(ExecutionContext *ctx, u64 symbol_index) {
+    ctx->error = {};
+    ctx->error.err_string = str_lit("Stack overflow, a function probably calls itself");
+    ctx->error.statement_id = symbol_index;
+    ctx->error.has_statement = true;
+}
+
+// result is pushed on ctx->stack just like the stack vm does
+ExecuteStatus execute_register(Program *program, ExecutionContext *ctx, u64 max_instructions) {
+    StackData *registers = ctx->registers.dat;
+
+    u64 pc = ctx->program_counter;
+    u64 base = ctx->register_base;
+    u64 segment = pc;
+    u64 executed = 0;
+    ExecuteStatus status = EXECUTE_SUSPENDED;
+    bool running = true;
+    while (running) {
+        RegBytecode *curr = program->reg_bytecode.dat + pc;
+        StackData *r = registers + base;
+
+        switch (curr->type) {
+            case REG_BYTECODE_INVALID: assert(false && "unreachable"); break;
+            case REG_BYTECODE_CALL: {
+                executed += pc - segment;
+                if (executed >= max_instructions) {
+                    running = false;
+                    break;
+                }
+                if (ctx->reg_frames.count == call_depth_limit(ctx)) {
+                    status = EXECUTE_ERROR;
+                    running = false;
+                    break;
+                }
+                executed += 1;
+
+                u64 frame_end = base + curr->dst + curr->b;
+                if (frame_end > ctx->registers.cap) {
+                    dynarray_reserve(&ctx->registers, frame_end);
+                    registers = ctx->registers.dat;
+                }
+                RegFrame frame = {};
+                frame.return_address = pc + 1;
+                frame.base = base;
+                dynarray_append(&ctx->reg_frames, frame);
+
+                base += curr->dst;
+                pc = curr->imm.u;
+                segment = pc;
+            } break;
+            case REG_BYTECODE_RETURN: {
+                executed += pc + 1 - segment;
+                StackData result = r[curr->a];
+                if (ctx->reg_frames.count == 0) {
+                    dynarray_append(&ctx->stack, result);
+                    status = EXECUTE_DONE;
+                    running = false;
+                    break;
+                }
+                // register 0 of the callee frame is the destination register of the call
+                r[0] = result;
+                RegFrame frame = dynarray_pop(&ctx->reg_frames);
+                base = frame.base;
+                pc = frame.return_address;
+                segment = pc;
+            } break;
+            case REG_BYTECODE_LOADK: {
+                r[curr->dst] = curr->imm;
+                pc += 1;
+            } break;
+            case REG_BYTECODE_LOAD_GLOBAL: {
+                r[curr->dst] = program->globals.dat[curr->imm.u];
+                pc += 1;
+            } break;
+            case REG_BYTECODE_MOVE: {
+                r[curr->dst] = r[curr->a];
+                pc += 1;
+            } break;
+            case REG_BYTECODE_NEG: {
+                r[curr->dst].f = -r[curr->a].f;
+                pc += 1;
+            } break;
+            case REG_BYTECODE_ADD: {
+                r[curr->dst].f = r[curr->a].f + r[curr->b].f;
+                pc += 1;
+            } break;
+            case REG_BYTECODE_SUB: {
+                r[curr->dst].f = r[curr->a].f - r[curr->b].f;
+                pc += 1;
+            } break;
+            case REG_BYTECODE_MUL: {
+                r[curr->dst].f = r[curr->a].f * r[curr->b].f;
+                pc += 1;
+            } break;
+            case REG_BYTECODE_DIV: {
+                r[curr->dst].f = r[curr->a].f / r[curr->b].f;
+                pc += 1;
+            } break;
+            case RegBytecodeType_COUNT: assert(false && "unreachable"); break;
+        }
+    }
+
+    ctx->program_counter = pc;
+    ctx->register_base = base;
+    ctx->instructions += executed;
+    return status;
+}
+
+#if defined(GCC) || defined(CLANG)
+#define HAS_THREADED_VM 1
+
+// labels as values and computed gotos are a gnu extension
+#ifdef CLANG
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wgnu-label-as-value"
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+// direct threaded version of the stack vm, every instruction holds the address of its handler
+// and each handler jumps straight to the next one, pc, sp and base are kept in locals.
+// With ctx == nullptr it only fills program->threaded_code, the handler addresses are local to this function
+ExecuteStatus execute_threaded(Program *program, ExecutionContext *ctx, u64 max_instructions) {
+    static const void *handlers[] = {
+        #define X(type) &&op_##type,
+        BytecodeTypeTable(X)
+        #undef X
+    };
+
+    if (!ctx) {
+        program->threaded_code.count = 0;
+        for (u64 i = 0; i < program->bytecode.count; ++i) {
+            Bytecode *code = program->bytecode.dat + i;
+            ThreadedCode t = {};
+            t.handler = handlers[code->type];
+            t.imm = code->imm;
+            dynarray_append(&program->threaded_code, t);
+        }
+        return EXECUTE_IDLE;
+    }
+
+    // verify_bytecode bounds every function by max_stack_depth, so this much room at every call
+    // keeps the pushes in bounds
+    u64 frame_slots = program->max_stack_depth;
+    dynarray_reserve(&ctx->stack, ctx->stack.count + frame_slots);
+
+    ThreadedCode *code = program->threaded_code.dat;
+    StackData *stack = ctx->stack.dat;
+    StackData *stack_end = stack + ctx->stack.cap;
+    StackData *sp = stack + ctx->stack.count;
+    StackData *base = stack + ctx->base_stackframe_index;
+    // next free frame, frames_end is one past the deepest call allowed
+    CallFrame *fp = ctx->frames.dat + ctx->frames.count;
+    CallFrame *frames_end = ctx->frames.dat + call_depth_limit(ctx) + 1;
+    u64 return_args = 0;
+
+    ThreadedCode *ip = code + ctx->program_counter;
+    // instructions are counted for each straight run of code when it ends at a call or return
+    ThreadedCode *segment = ip;
+    u64 executed = 0;
+    ExecuteStatus status = EXECUTE_SUSPENDED;
+    #define DISPATCH() goto *ip->handler
+
+    DISPATCH();
+
+    op_BYTECODE_INVALID: {
+        assert(false && "unreachable");
+        status = EXECUTE_ERROR;
+        goto leave;
+    }
+    op_BYTECODE_CALL: {
+        executed += (u64)(ip - segment);
+        if (executed >= max_instructions) goto leave;
+        if (fp == frames_end) {
+            status = EXECUTE_ERROR;
+            goto leave;
+        }
+        if ((u64)(stack_end - sp) < frame_slots) {
+            u64 sp_index = (u64)(sp - stack);
+            u64 base_index = (u64)(base - stack);
+            ctx->stack.count = sp_index;
+            dynarray_reserve(&ctx->stack, sp_index + frame_slots);
+            stack = ctx->stack.dat;
+            stack_end = stack + ctx->stack.cap;
+            sp = stack + sp_index;
+            base = stack + base_index;
+        }
+        executed += 1;
+        fp->return_address = (u64)(ip + 1 - code);
+        fp->base = (u64)(base - stack);
+        fp += 1;
+        base = sp;
+        ip = code + ip->imm.u;
+        segment = ip;
+        DISPATCH();
+    }
+    op_BYTECODE_RETURN: {
+        return_args = ip->imm.u;
+        goto return_common;
+    }
+    op_BYTECODE_RETURN0: {
+        return_args = 0;
+        goto return_common;
+    }
+    op_BYTECODE_RETURN1: {
+        return_args = 1;
+        goto return_common;
+    }
+    op_BYTECODE_RETURN2: {
+        return_args = 2;
+        goto return_common;
+    }
+    op_BYTECODE_RETURN3: {
+        return_args = 3;
+        goto return_common;
+    }
+    return_common: {
+        executed += (u64)(ip + 1 - segment);
+        // the locals and the arguments go in one step
+        StackData result = *(sp - 1);
+        sp = base - return_args;
+        *sp++ = result;
+        fp -= 1;
+        base = stack + fp->base;
+
+        if (fp->return_address == ENTRY_RETURN_ADDRESS) {
+            status = EXECUTE_DONE;
+            goto leave;
+        }
+        ip = code + fp->return_address;
+        segment = ip;
+        DISPATCH();
+    }
+    op_BYTECODE_PUSH_ARG: {
+        *sp++ = base[-1 - (s64)ip->imm.u];
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_PUSH_LOCAL: {
+        *sp++ = base[ip->imm.u];
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_PUSH: {
+        *sp++ = ip->imm;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_PUSH_GLOBAL: {
+        *sp++ = program->globals.dat[ip->imm.u];
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_NEG: {
+        (sp - 1)->f = -(sp - 1)->f;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_ADD: {
+        (sp - 2)->f = (sp - 1)->f + (sp - 2)->f;
+        sp -= 1;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_SUB: {
+        (sp - 2)->f = (sp - 1)->f - (sp - 2)->f;
+        sp -= 1;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_MUL: {
+        (sp - 2)->f = (sp - 1)->f * (sp - 2)->f;
+        sp -= 1;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_DIV: {
+        (sp - 2)->f = (sp - 1)->f / (sp - 2)->f;
+        sp -= 1;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_ADD_ARG: {
+        (sp - 1)->f = base[-1 - (s64)ip->imm.u].f + (sp - 1)->f;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_SUB_ARG: {
+        (sp - 1)->f = base[-1 - (s64)ip->imm.u].f - (sp - 1)->f;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_MUL_ARG: {
+        (sp - 1)->f = base[-1 - (s64)ip->imm.u].f * (sp - 1)->f;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_DIV_ARG: {
+        (sp - 1)->f = base[-1 - (s64)ip->imm.u].f / (sp - 1)->f;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_ADD_CONST: {
+        (sp - 1)->f = (sp - 1)->f + ip->imm.f;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_SUB_CONST: {
+        (sp - 1)->f = (sp - 1)->f - ip->imm.f;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_MUL_CONST: {
+        (sp - 1)->f = (sp - 1)->f * ip->imm.f;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_DIV_CONST: {
+        (sp - 1)->f = (sp - 1)->f / ip->imm.f;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_MULADD: {
+        // two statements so the compiler can't contract it into an fma, which rounds once
+        f64 product = (sp - 1)->f * (sp - 2)->f;
+        (sp - 3)->f = product + (sp - 3)->f;
+        sp -= 2;
+        ip += 1;
+        DISPATCH();
+    }
+    op_BYTECODE_ADDADD: {
+        f64 sum = (sp - 1)->f + (sp - 2)->f;
+        (sp - 3)->f = sum + (sp - 3)->f;
+        sp -= 2;
+        ip += 1;
+        DISPATCH();
+    }
+    #undef DISPATCH
+
+leave:
+    ctx->stack.count = (u64)(sp - stack);
+    ctx->base_stackframe_index = (u64)(base - stack);
+    ctx->program_counter = (u64)(ip - code);
+    ctx->frames.count = (u64)(fp - ctx->frames.dat);
+    ctx->instructions += executed;
+    return status;
+}
+
+#ifdef CLANG
+#pragma clang diagnostic pop
+#else
+#pragma GCC diagnostic pop
+#endif
+#else
+#define HAS_THREADED_VM 0
+#endif
+
+void build_threaded_code(Program *program) {
+#if HAS_THREADED_VM
+    execute_threaded(program, nullptr, 0);
+#else
+    (void)program;
+#endif
+}
+
+#ifdef x86_64
+#define HAS_JIT 1
+#else
+#define HAS_JIT 0
+#endif
+
+// vm registers below this live in xmm2.. inside a function, the rest and everything across a
+// call in the register file. xmm0 and xmm1 are scratch
+#define JIT_CACHED_REGISTERS 14
+// upper bound of the code of one register vm instruction, a call spills and reloads every cached register
+#define JIT_MAX_INSTRUCTION_BYTES (64 + 2 * 10 * JIT_CACHED_REGISTERS)
+
+// what jit_entry returns
+#define JIT_DONE 0
+#define JIT_OUT_OF_REGISTERS 1
+#define JIT_OUT_OF_DEPTH 2
+#define JIT_CANCELLED 3
+
+// read by jit_entry before it calls target
+struct JitArgs {
+    StackData *registers;
+    StackData *registers_end;
+    StackData *globals;
+    volatile u32 *cancel;
+    u64 depth_left;
+    const void *target;
+};
+
+typedef u32 (*JitEntry)(JitArgs *args);
+
+// cancel of contexts that have none
+u32 jit_no_cancel = 0;
+
+// native code keeps rbx at the frame of the current function in the register file, r12 at the
+// globals, r13 at the end of the register file, r14 at the calls left before MAX_CALL_DEPTH,
+// rbp at the cancel flag and r15 at the stack pointer jit_entry had before calling target
+#define JIT_FRAME X64_RBX
+#define JIT_GLOBALS X64_R12
+#define JIT_REGISTERS_END X64_R13
+#define JIT_DEPTH X64_R14
+#define JIT_CANCEL X64_RBP
+#define JIT_ENTRY_RSP X64_R15
+
+#ifdef _WIN32
+// xmm6..xmm15 are callee saved on windows
+#define JIT_SAVED_XMM 10
+#else
+#define JIT_SAVED_XMM 0
+#endif
+
+// xmm = vm register r
+void jit_load(Assembler *a, u32 xmm, u32 r, u32 cached) {
+    if (r < cached) {
+        asm_sse_rr(a, SSE_PD, SSE_MOVAPD, xmm, 2 + r);
+    } else {
+        asm_sse_rm(a, SSE_SD, SSE_MOVSD_LOAD, xmm, JIT_FRAME, (s32)(r * 8));
+    }
+}
+
+// vm register r = xmm
+void jit_store(Assembler *a, u32 r, u32 xmm, u32 cached) {
+    if (r < cached) {
+        asm_sse_rr(a, SSE_PD, SSE_MOVAPD, 2 + r, xmm);
+    } else {
+        asm_sse_rm(a, SSE_SD, SSE_MOVSD_STORE, xmm, JIT_FRAME, (s32)(r * 8));
+    }
+}
+
+// xmm = xmm op vm register r
+void jit_op(Assembler *a, u8 op, u32 xmm, u32 r, u32 cached) {
+    if (r < cached) {
+        asm_sse_rr(a, SSE_SD, op, xmm, 2 + r);
+    } else {
+        asm_sse_rm(a, SSE_SD, op, xmm, JIT_FRAME, (s32)(r * 8));
+    }
+}
+
+// calls are emitted before every function has an address, patched once all are placed
+struct JitCall {
+    u64 at;
+    u64 target_pc;
+};
+
+// translates the register vm code of every function to native code, execution falls back to the
+// register vm when this fails or the machine is not x86-64
+void jit_program(Program *program) {
+    program->has_jit = false;
+    dynarray_init_arena(&program->jit_offsets, program->reg_bytecode.arena);
+#if HAS_JIT
+    u64 needed = 4096 + program->reg_bytecode.count * JIT_MAX_INSTRUCTION_BYTES;
+    if (program->jit_capacity < needed) {
+        if (program->jit_memory) jit_memory_release(program->jit_memory, program->jit_capacity);
+        program->jit_capacity = needed * 2;
+        program->jit_memory = (u8 *)jit_memory_reserve(program->jit_capacity);
+        if (!program->jit_memory) {
+            program->jit_capacity = 0;
+            return;
+        }
+    } else if (!jit_memory_protect(program->jit_memory, program->jit_capacity, false)) {
+        return;
+    }
+
+    Assembler assembler = {};
+    Assembler *a = &assembler;
+    asm_init(a, program->jit_memory, program->jit_capacity);
+
+    // sign bit for negation, xorpd wants it 16 byte aligned
+    u64 sign_mask = a->count;
+    asm_u64(a, 0x8000000000000000ull);
+    asm_u64(a, 0);
+
+    // u32 jit_entry(JitArgs *args), saves what the platform abi wants saved and calls target
+    program->jit_entry_offset = a->count;
+#ifdef _WIN32
+    X64Reg args = X64_RCX;
+#else
+    X64Reg args = X64_RDI;
+#endif
+    X64Reg saved[] = {X64_RBX, X64_RBP, X64_R12, X64_R13, X64_R14, X64_R15,
+#ifdef _WIN32
+        X64_RDI, X64_RSI,
+#endif
+    };
+    for (u64 i = 0; i < ARRAY_SIZE(saved); ++i) asm_push(a, saved[i]);
+#if JIT_SAVED_XMM > 0
+    asm_alu_imm(a, X64_ALU_SUB, X64_RSP, JIT_SAVED_XMM * 16);
+    for (u32 i = 0; i < JIT_SAVED_XMM; ++i) asm_sse_rm(a, SSE_DQU, SSE_MOVDQU_STORE, 6 + i, X64_RSP, (s32)(i * 16));
+#endif
+    asm_mov_load(a, JIT_FRAME, args, offsetof(JitArgs, registers));
+    asm_mov_load(a, JIT_REGISTERS_END, args, offsetof(JitArgs, registers_end));
+    asm_mov_load(a, JIT_GLOBALS, args, offsetof(JitArgs, globals));
+    asm_mov_load(a, JIT_CANCEL, args, offsetof(JitArgs, cancel));
+    asm_mov_load(a, JIT_DEPTH, args, offsetof(JitArgs, depth_left));
+    asm_mov_load(a, X64_RAX, args, offsetof(JitArgs, target));
+    asm_mov_rr(a, JIT_ENTRY_RSP, X64_RSP);
+    asm_call_reg(a, X64_RAX);
+    asm_xor_eax(a);
+    u64 epilogue = a->count;
+#if JIT_SAVED_XMM > 0
+    for (u32 i = 0; i < JIT_SAVED_XMM; ++i) asm_sse_rm(a, SSE_DQU, SSE_MOVDQU_LOAD, 6 + i, X64_RSP, (s32)(i * 16));
+    asm_alu_imm(a, X64_ALU_ADD, X64_RSP, JIT_SAVED_XMM * 16);
+#endif
+    for (u64 i = ARRAY_SIZE(saved); i-- > 0;) asm_pop(a, saved[i]);
+    asm_ret(a);
+
+    // unwind every native frame at once and return the code from jit_entry
+    u64 exits[4] = {};
+    for (u32 code = JIT_OUT_OF_REGISTERS; code <= JIT_CANCELLED; ++code) {
+        exits[code] = a->count;
+        asm_mov_rr(a, X64_RSP, JIT_ENTRY_RSP);
+        asm_mov_eax_imm(a, code);
+        asm_patch_rel32(a, asm_jmp(a), epilogue);
+    }
+
+    u64 *pc_offsets = (u64 *)calloc(program->reg_bytecode.count + 1, sizeof(u64));
+    DynArray<JitCall> calls = {};
+    for (u64 symbol_index = 0; symbol_index < program->symbols.count; ++symbol_index) {
+        asm_align(a, 16);
+        u64 pc = program->reg_symbol_ids.dat[symbol_index];
+        pc_offsets[pc] = a->count;
+        dynarray_append(&program->jit_offsets, a->count);
+
+        u64 frame_size = program->reg_frame_sizes.dat[symbol_index];
+        u32 cached = frame_size < JIT_CACHED_REGISTERS ? (u32)frame_size : JIT_CACHED_REGISTERS;
+        u64 arg_count = program->symbol_arg_counts.dat[symbol_index];
+        for (u32 r = 0; r < cached && r < arg_count; ++r) {
+            asm_sse_rm(a, SSE_SD, SSE_MOVSD_LOAD, 2 + r, JIT_FRAME, (s32)(r * 8));
+        }
+
+        bool returned = false;
+        while (!returned) {
+            RegBytecode *curr = program->reg_bytecode.dat + pc;
+            switch (curr->type) {
+                case REG_BYTECODE_INVALID: assert(false && "unreachable"); break;
+                case REG_BYTECODE_CALL: {
+                    // the callee reads its arguments from the register file and may write
+                    // anything from dst on, registers below dst are kept there across the call
+                    for (u32 r = 0; r < cached && r < curr->dst + curr->a; ++r) {
+                        asm_sse_rm(a, SSE_SD, SSE_MOVSD_STORE, 2 + r, JIT_FRAME, (s32)(r * 8));
+                    }
+                    asm_cmp_mem32_imm8(a, JIT_CANCEL, 0, 0);
+                    asm_patch_rel32(a, asm_jcc(a, X64_CC_NE), exits[JIT_CANCELLED]);
+                    asm_dec(a, JIT_DEPTH);
+                    asm_patch_rel32(a, asm_jcc(a, X64_CC_S), exits[JIT_OUT_OF_DEPTH]);
+                    asm_lea(a, X64_RAX, JIT_FRAME, (s32)((curr->dst + curr->b) * 8));
+                    asm_cmp_rr(a, X64_RAX, JIT_REGISTERS_END);
+                    asm_patch_rel32(a, asm_jcc(a, X64_CC_A), exits[JIT_OUT_OF_REGISTERS]);
+
+                    asm_alu_imm(a, X64_ALU_ADD, JIT_FRAME, (s32)(curr->dst * 8));
+                    dynarray_append(&calls, JitCall {asm_call(a), curr->imm.u});
+                    asm_alu_imm(a, X64_ALU_SUB, JIT_FRAME, (s32)(curr->dst * 8));
+                    asm_inc(a, JIT_DEPTH);
+
+                    for (u32 r = 0; r < cached && r <= curr->dst; ++r) {
+                        asm_sse_rm(a, SSE_SD, SSE_MOVSD_LOAD, 2 + r, JIT_FRAME, (s32)(r * 8));
+                    }
+                } break;
+                case REG_BYTECODE_RETURN: {
+                    jit_load(a, 0, curr->a, cached);
+                    asm_sse_rm(a, SSE_SD, SSE_MOVSD_STORE, 0, JIT_FRAME, 0);
+                    asm_ret(a);
+                    returned = true;
+                } break;
+                case REG_BYTECODE_LOADK: {
+                    asm_mov_imm64(a, X64_RAX, curr->imm.u);
+                    asm_movq_xmm_gpr(a, 0, X64_RAX);
+                    jit_store(a, curr->dst, 0, cached);
+                } break;
+                case REG_BYTECODE_LOAD_GLOBAL: {
+                    asm_sse_rm(a, SSE_SD, SSE_MOVSD_LOAD, 0, JIT_GLOBALS, (s32)(curr->imm.u * 8));
+                    jit_store(a, curr->dst, 0, cached);
+                } break;
+                case REG_BYTECODE_MOVE: {
+                    jit_load(a, 0, curr->a, cached);
+                    jit_store(a, curr->dst, 0, cached);
+                } break;
+                case REG_BYTECODE_NEG: {
+                    jit_load(a, 0, curr->a, cached);
+                    asm_sse_rip(a, SSE_PD, SSE_XORPD, 0, sign_mask);
+                    jit_store(a, curr->dst, 0, cached);
+                } break;
+                case REG_BYTECODE_ADD:
+                case REG_BYTECODE_SUB:
+                case REG_BYTECODE_MUL:
+                case REG_BYTECODE_DIV: {
+                    u8 op = SSE_ADD;
+                    if (curr->type == REG_BYTECODE_SUB) op = SSE_SUB;
+                    if (curr->type == REG_BYTECODE_MUL) op = SSE_MUL;
+                    if (curr->type == REG_BYTECODE_DIV) op = SSE_DIV;
+                    jit_load(a, 0, curr->a, cached);
+                    jit_op(a, op, 0, curr->b, cached);
+                    jit_store(a, curr->dst, 0, cached);
+                } break;
+                case RegBytecodeType_COUNT: assert(false && "unreachable"); break;
+            }
+            pc += 1;
+        }
+    }
+    for (u64 i = 0; i < calls.count; ++i) {
+        asm_patch_rel32(a, calls.dat[i].at, pc_offsets[calls.dat[i].target_pc]);
+    }
+    calls.count = 0;
+    dynarray_shrink(&calls);
+    free(pc_offsets);
+
+    if (!jit_memory_protect(program->jit_memory, program->jit_capacity, true)) return;
+    program->has_jit = !a->overflow;
+#endif
+}
+
+// runs the function set up by execute_begin to completion in native code. The budget is not
+// checked, a cancel makes it return EXECUTE_SUSPENDED and resuming starts the call over, which
+// is fine since functions have no side effects
+ExecuteStatus execute_jit(Program *program, ExecutionContext *ctx) {
+    u64 symbol_index = ctx->symbol_index;
+    u64 arg_count = program->symbol_arg_counts.dat[symbol_index];
+    if (ctx->jit_differential) {
+        ctx->jit_args.count = 0;
+        for (u64 i = 0; i < arg_count; ++i) dynarray_append(&ctx->jit_args, ctx->registers.dat[i]);
+    }
+
+    JitEntry entry = (JitEntry)(void *)(program->jit_memory + program->jit_entry_offset);
+    JitArgs args = {};
+    args.globals = program->globals.dat;
+    args.cancel = ctx->cancel ? ctx->cancel : &jit_no_cancel;
+    args.target = program->jit_memory + program->jit_offsets.dat[symbol_index];
+    u32 result = JIT_OUT_OF_REGISTERS;
+    while (result == JIT_OUT_OF_REGISTERS) {
+        args.registers = ctx->registers.dat;
+        args.registers_end = ctx->registers.dat + ctx->registers.cap;
+        args.depth_left = call_depth_limit(ctx);
+        result = entry(&args);
+        // the arguments are untouched until the entry function returns, so it can just run again
+        if (result == JIT_OUT_OF_REGISTERS) dynarray_set_cap(&ctx->registers, ctx->registers.cap * 2);
+    }
+    if (result == JIT_CANCELLED) return EXECUTE_SUSPENDED;
+
+    ExecuteStatus status = result == JIT_DONE ? EXECUTE_DONE : EXECUTE_ERROR;
+    StackData value = ctx->registers.dat[0];
+    if (ctx->jit_differential) {
+        for (u64 i = 0; i < arg_count; ++i) ctx->registers.dat[i] = ctx->jit_args.dat[i];
+        ctx->reg_frames.count = 0;
+        ctx->program_counter = program->reg_symbol_ids.dat[symbol_index];
+        ctx->register_base = 0;
+        ExecuteStatus vm_status = execute_register(program, ctx, ~0ull);
+        ctx->reg_frames.count = 0;
+        StackData vm_value = {};
+        if (vm_status == EXECUTE_DONE) vm_value = dynarray_pop(&ctx->stack);
+        if (vm_status != status || vm_value.u != (status == EXECUTE_DONE ? value.u : 0)) {
+            ctx->error = {};
+            ctx->error.err_string = str_lit("Jit and register vm results differ");
+            ctx->error.statement_id = symbol_index;
+            ctx->error.has_statement = true;
+            return EXECUTE_ERROR;
+        }
+    }
+
+    if (status == EXECUTE_ERROR) {
+        set_stack_overflow_error(ctx, symbol_index);
+        return EXECUTE_ERROR;
+    }
+    dynarray_append(&ctx->stack, value);
+    return EXECUTE_DONE;
+}
+
+// symbol of the function the code at address belongs to, symbol_ids is ascending
+u64 symbol_at_address(Program *program, u64 address) {
+    u64 lo = 0;
+    u64 hi = program->symbols.count;
+    while (hi - lo > 1) {
+        u64 mid = lo + (hi - lo) / 2;
+        if (program->symbol_ids.dat[mid] <= address) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// drops the samples taken so far and samples every interval instructions from now on, 0 is
+// SAMPLE_INTERVAL. Needed before the first execution with the samples
+void samples_reset(Samples *samples, u64 interval) {
+    samples->interval = interval == 0 ? SAMPLE_INTERVAL : interval;
+    samples->countdown = samples->interval;
+    samples->frames.count = 0;
+    samples->sample_ends.count = 0;
+}
+
+void samples_free(Samples *samples) {
+    samples->frames.count = 0;
+    samples->sample_ends.count = 0;
+    dynarray_set_cap(&samples->frames, 0);
+    dynarray_set_cap(&samples->sample_ends, 0);
+}
+
+void take_sample(Samples *samples, ExecutionContext *ctx, u64 pc) {
+    dynarray_append(&samples->frames, pc);
+    // the call before each return address, the entry frame returns to nothing
+    for (u64 i = ctx->frames.count; i-- > 1;) {
+        dynarray_append(&samples->frames, ctx->frames.dat[i].return_address - 1);
+    }
+    dynarray_append(&samples->sample_ends, samples->frames.count);
+}
+
+// one line per distinct chain of calls with the number of samples in it, outermost function
+// first and separated by ';' as flame graph tools read them
+void print_collapsed_stacks(Program *program, Samples *samples, FILE *f) {
+    u64 sample_count = samples->sample_ends.count;
+    u64 *symbols = (u64 *)calloc(samples->frames.count + 1, sizeof(u64));
+    for (u64 i = 0; i < samples->frames.count; ++i) symbols[i] = symbol_at_address(program, samples->frames.dat[i]);
+
+    // first sample of every distinct chain and how many have it
+    u64 *firsts = (u64 *)calloc(sample_count + 1, sizeof(u64));
+    u64 *counts = (u64 *)calloc(sample_count + 1, sizeof(u64));
+    u64 distinct = 0;
+    for (u64 i = 0; i < sample_count; ++i) {
+        u64 start = i == 0 ? 0 : samples->sample_ends.dat[i - 1];
+        u64 count = samples->sample_ends.dat[i] - start;
+        u64 k = 0;
+        for (; k < distinct; ++k) {
+            u64 other = firsts[k] == 0 ? 0 : samples->sample_ends.dat[firsts[k] - 1];
+            if (samples->sample_ends.dat[firsts[k]] - other != count) continue;
+            if (memcmp(symbols + start, symbols + other, count * sizeof(u64)) == 0) break;
+        }
+        if (k == distinct) firsts[distinct++] = i;
+        counts[k] += 1;
+    }
+
+    for (u64 k = 0; k < distinct; ++k) {
+        u64 start = firsts[k] == 0 ? 0 : samples->sample_ends.dat[firsts[k] - 1];
+        u64 end = samples->sample_ends.dat[firsts[k]];
+        for (u64 j = end; j-- > start;) {
+            String name = program->symbols.dat[symbols[j]];
+            fprintf(f, "%.*s%s", (s32)name.count, name.dat, j == start ? "" : ";");
+        }
+        fprintf(f, " %llu\n", counts[k]);
+    }
+    free(counts);
+    free(firsts);
+    free(symbols);
+}
+
+#if HAS_PROFILER
+// counts and max depths back to 0, the memory is kept
+void profile_reset(Profile *profile) {
+    DynArray<ProfileFunction> functions = profile->functions;
+    DynArray<ProfileCall> calls = profile->calls;
+    *profile = {};
+    profile->functions = functions;
+    profile->functions.count = 0;
+    profile->calls = calls;
+    profile->calls.count = 0;
+}
+
+void profile_free(Profile *profile) {
+    profile->functions.count = 0;
+    profile->calls.count = 0;
+    dynarray_set_cap(&profile->functions, 0);
+    dynarray_set_cap(&profile->calls, 0);
+    *profile = {};
+}
+
+void profile_call(Profile *profile, u64 symbol_index, u64 call_depth) {
+    profile->functions.dat[symbol_index].calls += 1;
+    ProfileCall call = {};
+    call.symbol_index = symbol_index;
+    call.start = time_seconds();
+    dynarray_append(&profile->calls, call);
+    if (call_depth > profile->max_call_depth) profile->max_call_depth = call_depth;
+}
+
+void profile_return(Profile *profile) {
+    ProfileCall call = dynarray_pop(&profile->calls);
+    f64 elapsed = time_seconds() - call.start;
+    ProfileFunction *function = profile->functions.dat + call.symbol_index;
+    function->total_seconds += elapsed;
+    function->self_seconds += elapsed - call.callee_seconds;
+    if (profile->calls.count > 0) profile->calls.dat[profile->calls.count - 1].callee_seconds += elapsed;
+}
+
+void profile_instruction(Profile *profile, BytecodeType type, u64 stack_depth) {
+    profile->opcode_counts[type] += 1;
+    profile->functions.dat[profile->calls.dat[profile->calls.count - 1].symbol_index].instructions += 1;
+    if (stack_depth > profile->max_stack_depth) profile->max_stack_depth = stack_depth;
+}
+
+void profile_begin(Profile *profile, Program *program, u64 symbol_index) {
+    profile->executions += 1;
+    // a later compile can have more symbols
+    while (profile->functions.count < program->symbols.count) dynarray_append(&profile->functions, {});
+    profile->calls.count = 0;
+    profile_call(profile, symbol_index, 0);
+}
+
+// indices of the functions that were called, most self time first. Freed by the caller
+u64 *profile_function_order(Program *program, Profile *profile, u64 *count_out) {
+    u64 symbol_count = program->symbols.count;
+    if (profile->functions.count < symbol_count) symbol_count = profile->functions.count;
+    u64 *order = (u64 *)calloc(symbol_count + 1, sizeof(*order));
+    u64 count = 0;
+    for (u64 i = 0; i < symbol_count; ++i) {
+        if (profile->functions.dat[i].calls == 0) continue;
+        u64 j = count++;
+        while (j > 0 && profile->functions.dat[order[j - 1]].self_seconds < profile->functions.dat[i].self_seconds) {
+            order[j] = order[j - 1];
+            j -= 1;
+        }
+        order[j] = i;
+    }
+    *count_out = count;
+    return order;
+}
+
+u64 profile_instruction_count(Profile *profile) {
+    u64 total = 0;
+    for (u64 i = 0; i < BytecodeType_COUNT; ++i) total += profile->opcode_counts[i];
+    return total;
+}
+
+void print_profile(Program *program, Profile *profile, FILE *f) {
+    u64 total = profile_instruction_count(profile);
+    fprintf(f, "%llu executions, %llu instructions, max stack depth %llu, max call depth %llu\n", profile->executions, total, profile->max_stack_depth, profile->max_call_depth);
+
+    fprintf(f, "%-24s %14s %8s\n", "opcode", "count", "share");
+    for (u64 i = 0; i < BytecodeType_COUNT; ++i) {
+        u64 count = profile->opcode_counts[i];
+        if (count == 0) continue;
+        fprintf(f, "%-24.*s %14llu %7.2f%%\n", (s32)str_BytecodeType[i].count, str_BytecodeType[i].dat, count, 100.0 * (f64)count / (f64)total);
+    }
+
+    fprintf(f, "%-24s %12s %14s %12s %12s\n", "function", "calls", "instructions", "total ms", "self ms");
+    u64 count = 0;
+    u64 *order = profile_function_order(program, profile, &count);
+    for (u64 i = 0; i < count; ++i) {
+        String name = program->symbols.dat[order[i]];
+        ProfileFunction *function = profile->functions.dat + order[i];
+        fprintf(f, "%-24.*s %12llu %14llu %12.3f %12.3f\n", (s32)name.count, name.dat, function->calls, function->instructions, function->total_seconds * 1000, function->self_seconds * 1000);
+    }
+    free(order);
+}
+
+// symbol and opcode names are identifiers so nothing needs escaping
+void print_profile_json(Program *program, Profile *profile, FILE *f) {
+    fprintf(f, "{\"executions\": %llu, \"instructions\": %llu, \"max_stack_depth\": %llu, \"max_call_depth\": %llu,\n", profile->executions, profile_instruction_count(profile), profile->max_stack_depth, profile->max_call_depth);
+
+    fprintf(f, " \"opcodes\": {");
+    bool first = true;
+    for (u64 i = 0; i < BytecodeType_COUNT; ++i) {
+        if (profile->opcode_counts[i] == 0) continue;
+        fprintf(f, "%s\"%.*s\": %llu", first ? "" : ", ", (s32)str_BytecodeType[i].count, str_BytecodeType[i].dat, profile->opcode_counts[i]);
+        first = false;
+    }
+    fprintf(f, "},\n");
+
+    fprintf(f, " \"functions\": [");
+    u64 count = 0;
+    u64 *order = profile_function_order(program, profile, &count);
+    for (u64 i = 0; i < count; ++i) {
+        String name = program->symbols.dat[order[i]];
+        ProfileFunction *function = profile->functions.dat + order[i];
+        fprintf(f, "%s\n  {\"name\": \"%.*s\", \"calls\": %llu, \"instructions\": %llu, \"total_seconds\": %.9f, \"self_seconds\": %.9f}", i == 0 ? "" : ",", (s32)name.count, name.dat, function->calls, function->instructions, function->total_seconds, function->self_seconds);
+    }
+    free(order);
+    fprintf(f, "]}\n");
+}
+#endif
+
+ExecuteStatus execute_stack(Program *program, ExecutionContext *ctx, u64 max_instructions) {
+    // verify_bytecode bounds every function by max_stack_depth, with that much room reserved at
+    // entry and at every call the pushes and pops need no checks
+    u64 frame_slots = program->max_stack_depth;
+    dynarray_reserve(&ctx->stack, ctx->stack.count + frame_slots);
+
+    StackData *stack = ctx->stack.dat;
+    StackData *stack_end = stack + ctx->stack.cap;
+    StackData *sp = stack + ctx->stack.count;
+    StackData *base = stack + ctx->base_stackframe_index;
+#if HAS_PROFILER
+    Profile *profile = ctx->profile;
+#endif
+    Samples *samples = ctx->samples;
+    u64 sample_countdown = samples ? samples->countdown : 0;
+
+    u64 segment = ctx->program_counter;
+    u64 executed = 0;
+    ExecuteStatus status = EXECUTE_SUSPENDED;
+    bool running = true;
+    while (running) {
+
+        Bytecode *curr = program->bytecode.dat + ctx->program_counter;
+        if (samples && --sample_countdown == 0) {
+            take_sample(samples, ctx, ctx->program_counter);
+            sample_countdown = samples->interval;
+        }
+#if HAS_PROFILER
+        // a call is counted once it is made, it can stop the slice first
+        if (profile && curr->type != BYTECODE_CALL) profile_instruction(profile, curr->type, (u64)(sp - stack) - ctx->entry_stack_count);
+#endif
+
+        switch (curr->type) {
+
+            case BYTECODE_INVALID: assert(false && "unreachable"); break;
+            case BYTECODE_CALL: {
+                executed += ctx->program_counter - segment;
+                if (executed >= max_instructions) {
+                    running = false;
+                    break;
+                }
+                if (ctx->frames.count > call_depth_limit(ctx)) {
+                    status = EXECUTE_ERROR;
+                    running = false;
+                    break;
+                }
+                if ((u64)(stack_end - sp) < frame_slots) {
+                    u64 sp_index = (u64)(sp - stack);
+                    u64 base_index = (u64)(base - stack);
+                    ctx->stack.count = sp_index;
+                    dynarray_reserve(&ctx->stack, sp_index + frame_slots);
+                    stack = ctx->stack.dat;
+                    stack_end = stack + ctx->stack.cap;
+                    sp = stack + sp_index;
+                    base = stack + base_index;
+                }
+                executed += 1;
+
+                CallFrame frame = {};
+                frame.return_address = ctx->program_counter + 1;
+                frame.base = (u64)(base - stack);
+                ctx->frames.dat[ctx->frames.count++] = frame;
+                base = sp;
+#if HAS_PROFILER
+                if (profile) {
+                    profile_instruction(profile, curr->type, (u64)(sp - stack) - ctx->entry_stack_count);
+                    profile_call(profile, symbol_at_address(program, curr->imm.u), ctx->frames.count - 1);
+                }
+#endif
+
+                ctx->program_counter = curr->imm.u;
+                segment = ctx->program_counter;
+            } break;
+            case BYTECODE_RETURN:
+            case BYTECODE_RETURN0:
+            case BYTECODE_RETURN1:
+            case BYTECODE_RETURN2:
+            case BYTECODE_RETURN3: {
+                executed += ctx->program_counter + 1 - segment;
+                // the locals and the arguments go in one step
+                StackData result = *(sp - 1);
+                sp = base - return_arg_count(curr);
+                *sp++ = result;
+#if HAS_PROFILER
+                if (profile) profile_return(profile);
+#endif
+
+                CallFrame frame = ctx->frames.dat[--ctx->frames.count];
+                base = stack + frame.base;
+                ctx->program_counter = frame.return_address;
+                segment = frame.return_address;
+
+                if (frame.return_address == ENTRY_RETURN_ADDRESS) {
+                    status = EXECUTE_DONE;
+                    running = false;
+                    break;
+                }
+            } break;
+            case BYTECODE_PUSH_ARG: {
+                *sp++ = base[-1 - (s64)curr->imm.u];
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_PUSH_LOCAL: {
+                *sp++ = base[curr->imm.u];
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_PUSH: {
+                *sp++ = curr->imm;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_PUSH_GLOBAL: {
+                *sp++ = program->globals.dat[curr->imm.u];
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_NEG: {
+                sp[-1].f = -sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_ADD: {
+                sp -= 1;
+                sp[-1].f = sp[0].f + sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_SUB: {
+                sp -= 1;
+                sp[-1].f = sp[0].f - sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_MUL: {
+                sp -= 1;
+                sp[-1].f = sp[0].f * sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_DIV: {
+                sp -= 1;
+                sp[-1].f = sp[0].f / sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_ADD_ARG: {
+                sp[-1].f = base[-1 - (s64)curr->imm.u].f + sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_SUB_ARG: {
+                sp[-1].f = base[-1 - (s64)curr->imm.u].f - sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_MUL_ARG: {
+                sp[-1].f = base[-1 - (s64)curr->imm.u].f * sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_DIV_ARG: {
+                sp[-1].f = base[-1 - (s64)curr->imm.u].f / sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_ADD_CONST: {
+                sp[-1].f = sp[-1].f + curr->imm.f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_SUB_CONST: {
+                sp[-1].f = sp[-1].f - curr->imm.f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_MUL_CONST: {
+                sp[-1].f = sp[-1].f * curr->imm.f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_DIV_CONST: {
+                sp[-1].f = sp[-1].f / curr->imm.f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_MULADD: {
+                sp -= 2;
+                f64 product = sp[1].f * sp[0].f;
+                sp[-1].f = product + sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BYTECODE_ADDADD: {
+                sp -= 2;
+                f64 sum = sp[1].f + sp[0].f;
+                sp[-1].f = sum + sp[-1].f;
+                ctx->program_counter += 1;
+            } break;
+            case BytecodeType_COUNT: assert(false && "unreachable"); break;
+        }
+    }
+
+    ctx->stack.count = (u64)(sp - stack);
+    ctx->base_stackframe_index = (u64)(base - stack);
+    if (samples) samples->countdown = sample_countdown;
+    ctx->instructions += executed;
+    return status;
+}
+
+void compact_write_index(DynArray<u8> *code, u64 value) {
+    while (value >= 0x80) {
+        dynarray_append(code, (u8)(value | 0x80));
+        value >>= 7;
+    }
+    dynarray_append(code, (u8)value);
+}
+
+// operands are LEB128 so the indices of a typical program take one byte
+u64 compact_read_index(u8 *code, u64 *pc) {
+    u8 b = code[(*pc)++];
+    if (b < 0x80) return b;
+    u64 value = b & 0x7F;
+    for (u32 shift = 7;; shift += 7) {
+        b = code[(*pc)++];
+        value |= (u64)(b & 0x7F) << shift;
+        if (b < 0x80) return value;
+    }
+}
+
+// NEG..DIV are one byte and the rest two most of the time, instead of 16 bytes each. Equal
+// constants share one entry of the pool. Call targets are a fixed u32 so they can be patched
+// once every offset is known
+void compact_program(Program *program) {
+    DynArray<u8> *code = &program->compact_code;
+    code->count = 0;
+    program->constants.count = 0;
+    program->compact_symbol_ids.count = 0;
+
+    u64 *offsets = (u64 *)calloc(program->bytecode.count + 1, sizeof(u64));
+    // constant index + 1 open addressed on the bits of the constant, 0 is empty
+    u64 cap = next_power_of_two(program->bytecode.count * 2 + 16);
+    u32 *table = (u32 *)calloc(cap, sizeof(u32));
+    assert(offsets && table);
+
+    for (u64 i = 0; i < program->bytecode.count; ++i) {
+        Bytecode *b = program->bytecode.dat + i;
+        offsets[i] = code->count;
+        dynarray_append(code, (u8)b->type);
+        switch (b->type) {
+            case BYTECODE_CALL: {
+                // bytecode index of the callee for now
+                for (u32 k = 0; k < 4; ++k) {
+                    dynarray_append(code, (u8)(b->imm.u >> (k * 8)));
+                }
+            } break;
+            case BYTECODE_PUSH:
+            case BYTECODE_ADD_CONST:
+            case BYTECODE_SUB_CONST:
+            case BYTECODE_MUL_CONST:
+            case BYTECODE_DIV_CONST: {
+                u64 slot = hash_combine(0, b->imm.u) & (cap - 1);
+                while (table[slot] != 0 && program->constants.dat[table[slot] - 1].u != b->imm.u) {
+                    slot = (slot + 1) & (cap - 1);
+                }
+                if (table[slot] == 0) {
+                    dynarray_append(&program->constants, b->imm);
+                    table[slot] = (u32)program->constants.count;
+                }
+                compact_write_index(code, table[slot] - 1);
+            } break;
+            case BYTECODE_RETURN:
+            case BYTECODE_PUSH_ARG:
+            case BYTECODE_PUSH_LOCAL:
+            case BYTECODE_PUSH_GLOBAL:
+            case BYTECODE_ADD_ARG:
+            case BYTECODE_SUB_ARG:
+            case BYTECODE_MUL_ARG:
+            case BYTECODE_DIV_ARG: {
+                compact_write_index(code, b->imm.u);
+            } break;
+            case BYTECODE_RETURN0:
+            case BYTECODE_RETURN1:
+            case BYTECODE_RETURN2:
+            case BYTECODE_RETURN3:
+            case BYTECODE_NEG:
+            case BYTECODE_ADD:
+            case BYTECODE_SUB:
+            case BYTECODE_MUL:
+            case BYTECODE_DIV:
+            case BYTECODE_MULADD:
+            case BYTECODE_ADDADD: {
+                // no operand
+            } break;
+            // verify_bytecode rejected it
+            case BYTECODE_INVALID: assert(false && "unreachable"); break;
+            case BytecodeType_COUNT: assert(false && "unreachable"); break;
+        }
+    }
+    offsets[program->bytecode.count] = code->count;
+
+    for (u64 i = 0; i < program->bytecode.count; ++i) {
+        if (program->bytecode.dat[i].type != BYTECODE_CALL) continue;
+        u32 target = (u32)offsets[program->bytecode.dat[i].imm.u];
+        memcpy(code->dat + offsets[i] + 1, &target, sizeof(target));
+    }
+    for (u64 i = 0; i < program->symbol_ids.count; ++i) {
+        dynarray_append(&program->compact_symbol_ids, offsets[program->symbol_ids.dat[i]]);
+    }
+    free(offsets);
+    free(table);
+}
+
+// execute_stack on compact_code, program_counter is a byte offset
+ExecuteStatus execute_compact(Program *program, ExecutionContext *ctx, u64 max_instructions) {
+    // unchecked pushes and pops as in execute_stack
+    u64 frame_slots = program->max_stack_depth;
+    dynarray_reserve(&ctx->stack, ctx->stack.count + frame_slots);
+
+    StackData *stack = ctx->stack.dat;
+    StackData *stack_end = stack + ctx->stack.cap;
+    StackData *sp = stack + ctx->stack.count;
+    StackData *base = stack + ctx->base_stackframe_index;
+
+    u8 *code = program->compact_code.dat;
+    StackData *constants = program->constants.dat;
+    u64 pc = ctx->program_counter;
+    u64 executed = 0;
+    ExecuteStatus status = EXECUTE_SUSPENDED;
+    bool running = true;
+    while (running) {
+        u64 at = pc;
+        BytecodeType type = (BytecodeType)code[pc++];
+        switch (type) {
+            case BYTECODE_INVALID: assert(false && "unreachable"); break;
+            case BYTECODE_CALL: {
+                if (executed >= max_instructions) {
+                    pc = at;
+                    running = false;
+                    break;
+                }
+                if (ctx->frames.count > call_depth_limit(ctx)) {
+                    pc = at;
+                    status = EXECUTE_ERROR;
+                    running = false;
+                    break;
+                }
+                if ((u64)(stack_end - sp) < frame_slots) {
+                    u64 sp_index = (u64)(sp - stack);
+                    u64 base_index = (u64)(base - stack);
+                    ctx->stack.count = sp_index;
+                    dynarray_reserve(&ctx->stack, sp_index + frame_slots);
+                    stack = ctx->stack.dat;
+                    stack_end = stack + ctx->stack.cap;
+                    sp = stack + sp_index;
+                    base = stack + base_index;
+                }
+                executed += 1;
+
+                u32 target = 0;
+                memcpy(&target, code + pc, sizeof(target));
+                pc += sizeof(target);
+
+                CallFrame frame = {};
+                frame.return_address = pc;
+                frame.base = (u64)(base - stack);
+                ctx->frames.dat[ctx->frames.count++] = frame;
+                base = sp;
+
+                pc = target;
+            } break;
+            case BYTECODE_RETURN:
+            case BYTECODE_RETURN0:
+            case BYTECODE_RETURN1:
+            case BYTECODE_RETURN2:
+            case BYTECODE_RETURN3: {
+                executed += 1;
+                u64 arg_count = (u64)(type - BYTECODE_RETURN0);
+                if (type == BYTECODE_RETURN) arg_count = compact_read_index(code, &pc);
+                StackData result = *(sp - 1);
+                sp = base - arg_count;
+                *sp++ = result;
+
+                CallFrame frame = ctx->frames.dat[--ctx->frames.count];
+                base = stack + frame.base;
+                pc = frame.return_address;
+
+                if (frame.return_address == ENTRY_RETURN_ADDRESS) {
+                    status = EXECUTE_DONE;
+                    running = false;
+                    break;
+                }
+            } break;
+            case BYTECODE_PUSH_ARG: {
+                executed += 1;
+                u64 arg = compact_read_index(code, &pc);
+                *sp++ = base[-1 - (s64)arg];
+            } break;
+            case BYTECODE_PUSH_LOCAL: {
+                executed += 1;
+                u64 local = compact_read_index(code, &pc);
+                *sp++ = base[local];
+            } break;
+            case BYTECODE_PUSH: {
+                executed += 1;
+                *sp++ = constants[compact_read_index(code, &pc)];
+            } break;
+            case BYTECODE_PUSH_GLOBAL: {
+                executed += 1;
+                *sp++ = program->globals.dat[compact_read_index(code, &pc)];
+            } break;
+            case BYTECODE_NEG: {
+                executed += 1;
+                StackData *sd = sp - 1;
+                sd->f = -sd->f;
+            } break;
+            case BYTECODE_ADD: {
+                executed += 1;
+                StackData sd1 = *--sp;
+                StackData *sd2 = sp - 1;
+                sd2->f = sd1.f + sd2->f;
+            } break;
+            case BYTECODE_SUB: {
+                executed += 1;
+                StackData sd1 = *--sp;
+                StackData *sd2 = sp - 1;
+                sd2->f = sd1.f - sd2->f;
+            } break;
+            case BYTECODE_MUL: {
+                executed += 1;
+                StackData sd1 = *--sp;
+                StackData *sd2 = sp - 1;
+                sd2->f = sd1.f * sd2->f;
+            } break;
+            case BYTECODE_DIV: {
+                executed += 1;
+                StackData sd1 = *--sp;
+                StackData *sd2 = sp - 1;
+                sd2->f = sd1.f / sd2->f;
+            } break;
+            case BYTECODE_ADD_ARG: {
+                executed += 1;
+                u64 arg = compact_read_index(code, &pc);
+                StackData *top = sp - 1;
+                top->f = base[-1 - (s64)arg].f + top->f;
+            } break;
+            case BYTECODE_SUB_ARG: {
+                executed += 1;
+                u64 arg = compact_read_index(code, &pc);
+                StackData *top = sp - 1;
+                top->f = base[-1 - (s64)arg].f - top->f;
+            } break;
+            case BYTECODE_MUL_ARG: {
+                executed += 1;
+                u64 arg = compact_read_index(code, &pc);
+                StackData *top = sp - 1;
+                top->f = base[-1 - (s64)arg].f * top->f;
+            } break;
+            case BYTECODE_DIV_ARG: {
+                executed += 1;
+                u64 arg = compact_read_index(code, &pc);
+                StackData *top = sp - 1;
+                top->f = base[-1 - (s64)arg].f / top->f;
+            } break;
+            case BYTECODE_ADD_CONST: {
+                executed += 1;
+                StackData *top = sp - 1;
+                top->f = top->f + constants[compact_read_index(code, &pc)].f;
+            } break;
+            case BYTECODE_SUB_CONST: {
+                executed += 1;
+                StackData *top = sp - 1;
+                top->f = top->f - constants[compact_read_index(code, &pc)].f;
+            } break;
+            case BYTECODE_MUL_CONST: {
+                executed += 1;
+                StackData *top = sp - 1;
+                top->f = top->f * constants[compact_read_index(code, &pc)].f;
+            } break;
+            case BYTECODE_DIV_CONST: {
+                executed += 1;
+                StackData *top = sp - 1;
+                top->f = top->f / constants[compact_read_index(code, &pc)].f;
+            } break;
+            case BYTECODE_MULADD: {
+                executed += 1;
+                StackData sd1 = *--sp;
+                StackData sd2 = *--sp;
+                StackData *top = sp - 1;
+                f64 product = sd1.f * sd2.f;
+                top->f = product + top->f;
+            } break;
+            case BYTECODE_ADDADD: {
+                executed += 1;
+                StackData sd1 = *--sp;
+                StackData sd2 = *--sp;
+                StackData *top = sp - 1;
+                f64 sum = sd1.f + sd2.f;
+                top->f = sum + top->f;
+            } break;
+            case BytecodeType_COUNT: assert(false && "unreachable"); break;
+        }
+    }
+
+    ctx->stack.count = (u64)(sp - stack);
+    ctx->base_stackframe_index = (u64)(base - stack);
+    ctx->program_counter = pc;
+    ctx->instructions += executed;
+    return status;
+}
+
+// drops a suspended execution and everything it pushed
+void execute_abort(ExecutionContext *ctx) {
+    ctx->stack.count = ctx->entry_stack_count;
+    ctx->base_stackframe_index = ctx->entry_base;
+    ctx->frames.count = 0;
+    ctx->reg_frames.count = 0;
+    ctx->status = EXECUTE_IDLE;
+}
+
+// the one name lookup, keep the handle to call func again without any string work
+FunctionHandle get_function_handle(Program *program, String func) {
+    u64 symbol_index = 0;
+    if (!get_symbol_index_from_name(program, func, &symbol_index)) return FUNCTION_HANDLE_INVALID;
+    return symbol_index;
+}
+
+u64 function_arg_count(Program *program, FunctionHandle handle) {
+    assert(handle < program->symbols.count);
+    return program->symbol_arg_counts.dat[handle];
+}
+
+// sets up a call of the function to be run by execute_resume, an unfinished execution is dropped
+bool execute_begin_handle(Program *program, ExecutionContext *ctx, VmMode vm_mode, FunctionHandle handle, f64 *args, u64 func_args_count) {
+    if (ctx->status == EXECUTE_SUSPENDED) execute_abort(ctx);
+    if (handle >= program->symbols.count || program->symbol_arg_counts.dat[handle] != func_args_count) {
+        return false;
+    }
+    u64 symbol_index = handle;
+
+    ctx->status = EXECUTE_SUSPENDED;
+    ctx->vm_mode = vm_mode;
+    if (!HAS_THREADED_VM && ctx->vm_mode == VM_THREADED) ctx->vm_mode = VM_STACK;
+    if (!program->has_jit && ctx->vm_mode == VM_JIT) ctx->vm_mode = VM_REGISTER;
+#if HAS_PROFILER
+    // only the stack vm counts
+    if (ctx->profile) ctx->vm_mode = VM_STACK;
+#endif
+    // samples are addresses into the bytecode
+    if (ctx->samples) ctx->vm_mode = VM_STACK;
+    ctx->symbol_index = symbol_index;
+    ctx->instructions = 0;
+    ctx->entry_stack_count = ctx->stack.count;
+    ctx->entry_base = ctx->base_stackframe_index;
+
+    if (ctx->vm_mode == VM_REGISTER || ctx->vm_mode == VM_JIT) {
+        dynarray_reserve(&ctx->registers, program->reg_frame_sizes.dat[symbol_index]);
+        ctx->reg_frames.count = 0;
+        for (u64 j = 0; j < func_args_count; ++j) {
+            ctx->registers.dat[j].f = args[j];
+        }
+        ctx->program_counter = program->reg_symbol_ids.dat[symbol_index];
+        ctx->register_base = 0;
+        return true;
+    }
+
+    for (u64 j = func_args_count; j-- > 0;) {
+        StackData sd = {};
+        sd.f = args[j];
+        dynarray_append(&ctx->stack, sd);
+    }
+
+    // the entry function gets a frame like a BYTECODE_CALL does so arguments are found at the same offsets
+    ctx->frames.count = 0;
+    dynarray_reserve(&ctx->frames, call_depth_limit(ctx) + 1);
+    CallFrame entry = {};
+    entry.return_address = ENTRY_RETURN_ADDRESS;
+    entry.base = ctx->base_stackframe_index;
+    ctx->frames.dat[ctx->frames.count++] = entry;
+    ctx->base_stackframe_index = ctx->stack.count;
+
+    ctx->program_counter = program->symbol_ids.dat[symbol_index];
+    if (ctx->vm_mode == VM_COMPACT) ctx->program_counter = program->compact_symbol_ids.dat[symbol_index];
+#if HAS_PROFILER
+    if (ctx->profile) profile_begin(ctx->profile, program, symbol_index);
+#endif
+    // arg n - 1
+    // arg 1
+    // arg 0
+    // locals <- base
+    // stuff
+    return true;
+}
+
+bool execute_begin(Program *program, ExecutionContext *ctx, VmMode vm_mode, String func, f64 *args, u64 func_args_count) {
+    return execute_begin_handle(program, ctx, vm_mode, get_function_handle(program, func), args, func_args_count);
+}
+
+// runs the execution set up by execute_begin until it finishes or the budget is used up,
+// after EXECUTE_DONE the result is on top of ctx->stack. After EXECUTE_ERROR the
+// execution is dropped and the error is in ctx->error
+ExecuteStatus execute_resume(Program *program, ExecutionContext *ctx, ExecuteBudget budget) {
+    assert(ctx->status == EXECUTE_SUSPENDED);
+
+    f64 start_time = budget.seconds > 0 ? time_seconds() : 0;
+    u64 start_instructions = ctx->instructions;
+    while (ctx->status == EXECUTE_SUSPENDED) {
+        u64 used = ctx->instructions - start_instructions;
+        if (budget.instructions > 0 && used >= budget.instructions) break;
+        if (budget.seconds > 0 && used > 0 && time_seconds() - start_time >= budget.seconds) break;
+
+        u64 slice = ~0ull;
+        if (budget.seconds > 0) slice = EXECUTE_SLICE_INSTRUCTIONS;
+        if (budget.instructions > 0 && budget.instructions - used < slice) slice = budget.instructions - used;
+
+        switch (ctx->vm_mode) {
+            case VM_STACK: ctx->status = execute_stack(program, ctx, slice); break;
+            case VM_COMPACT: ctx->status = execute_compact(program, ctx, slice); break;
+            case VM_REGISTER: ctx->status = execute_register(program, ctx, slice); break;
+#if HAS_THREADED_VM
+            case VM_THREADED: ctx->status = execute_threaded(program, ctx, slice); break;
+#else
+            case VM_THREADED: assert(false && "unreachable"); break;
+#endif
+            case VM_JIT: {
+                ctx->status = execute_jit(program, ctx);
+                // cancelled, running it again right away would just be cancelled again
+                if (ctx->status == EXECUTE_SUSPENDED) return ctx->status;
+            } break;
+            case VmMode_COUNT: assert(false && "unreachable"); break;
+        }
+    }
+
+    if (ctx->status == EXECUTE_ERROR) {
+        execute_abort(ctx);
+        ctx->status = EXECUTE_ERROR;
+        // the jit sets its own error
+        if (ctx->vm_mode != VM_JIT) set_stack_overflow_error(ctx, ctx->symbol_index);
+    }
+    return ctx->status;
+}
+
+// runs the function to completion and pushes the result on ctx->stack, gives up when ctx->cancel
+// gets set
+bool execute_program_handle(Program *program, ExecutionContext *ctx, VmMode vm_mode, FunctionHandle handle, f64 *args, u64 func_args_count) {
+    if (!execute_begin_handle(program, ctx, vm_mode, handle, args, func_args_count)) return false;
+
+    ExecuteBudget budget = {};
+    budget.instructions = EXECUTE_SLICE_INSTRUCTIONS;
+    while (true) {
+        ExecuteStatus status = execute_resume(program, ctx, budget);
+        if (status != EXECUTE_SUSPENDED) return status == EXECUTE_DONE;
+        if (ctx->cancel && atomic_load(ctx->cancel) != 0) {
+            execute_abort(ctx);
+            return false;
+        }
+    }
+}
+
+bool execute_program(Program *program, ExecutionContext *ctx, VmMode vm_mode, String func, f64 *args, u64 func_args_count) {
+    return execute_program_handle(program, ctx, vm_mode, get_function_handle(program, func), args, func_args_count);
+}
+
+// runs a function of the last compile on inter->exec, runtime errors end up in inter->errors
+bool execute_handle(Interpreter *inter, FunctionHandle handle, f64 *args, u64 func_args_count) {
+    if (inter->errors.count > 0) return false;
+    inter->exec.cancel = inter->cancel;
+#if HAS_PROFILER
+    inter->exec.profile = inter->profile;
+#endif
+    inter->exec.samples = inter->samples;
+    bool done = execute_program_handle(&inter->program, &inter->exec, inter->vm_mode, handle, args, func_args_count);
+#if HAS_PROFILER
+    // the evaluation of globals on exec is not profiled
+    inter->exec.profile = nullptr;
+#endif
+    inter->exec.samples = nullptr;
+    if (done) return true;
+    if (inter->exec.status == EXECUTE_ERROR) dynarray_append(&inter->errors, inter->exec.error);
+    return false;
+}
+
+bool execute(Interpreter *inter, String func, f64 *args, u64 func_args_count) {
+    return execute_handle(inter, get_function_handle(&inter->program, func), args, func_args_count);
+}
+
+// evaluates func for count argument tuples given as one column of count values per parameter,
+// every opcode is dispatched once per block of BATCH_LANES lanes. Returns EXECUTE_IDLE when
+// the function does not exist, takes another number of arguments or is too long for the batch stack
+ExecuteStatus execute_program_batch_handle(Program *program, ExecutionContext *ctx, FunctionHandle handle, f64 **arg_columns, u64 func_args_count, f64 *results, u64 count) {
+    if (handle >= program->symbols.count || program->symbol_arg_counts.dat[handle] != func_args_count) {
+        return EXECUTE_IDLE;
+    }
+    u64 symbol_index = handle;
+    u64 func_id = program->symbol_ids.dat[symbol_index];
+
+    // every function has to fit in the stack on top of the arguments
+    if (func_args_count + program->max_stack_depth > BATCH_STACK_SLOTS) return EXECUTE_IDLE;
+
+    if (!simd_kernels.add) simd_init();
+    dynarray_reserve(&ctx->batch_stack, BATCH_STACK_SLOTS * BATCH_LANES);
+
+    f64 *stack = ctx->batch_stack.dat;
+    #define SLOT(i) (stack + (i) * BATCH_LANES)
+    // operand of the _CONST ops
+    f64 constant[BATCH_LANES];
+
+    for (u64 start = 0; start < count; start += BATCH_LANES) {
+        u64 lanes = count - start;
+        if (lanes > BATCH_LANES) lanes = BATCH_LANES;
+
+        u64 sp = 0;
+        for (u64 j = func_args_count; j-- > 0;) {
+            memcpy(SLOT(sp), arg_columns[j] + start, lanes * sizeof(f64));
+            sp += 1;
+        }
+
+        ctx->batch_frames.count = 0;
+        u64 base = sp;
+        u64 pc = func_id;
+        bool running = true;
+        while (running) {
+            Bytecode *curr = program->bytecode.dat + pc;
+
+            switch (curr->type) {
+                case BYTECODE_INVALID: assert(false && "unreachable"); break;
+                case BYTECODE_CALL: {
+                    if (ctx->batch_frames.count == call_depth_limit(ctx) || sp + program->max_stack_depth > BATCH_STACK_SLOTS) {
+                        set_stack_overflow_error(ctx, symbol_index);
+                        return EXECUTE_ERROR;
+                    }
+                    BatchFrame frame = {};
+                    frame.return_address = pc + 1;
+                    frame.base = base;
+                    dynarray_append(&ctx->batch_frames, frame);
+
+                    base = sp;
+                    pc = curr->imm.u;
+                } break;
+                case BYTECODE_RETURN:
+                case BYTECODE_RETURN0:
+                case BYTECODE_RETURN1:
+                case BYTECODE_RETURN2:
+                case BYTECODE_RETURN3: {
+                    assert(sp > 0);
+                    f64 *result = SLOT(sp - 1);
+                    if (ctx->batch_frames.count == 0) {
+                        memcpy(results + start, result, lanes * sizeof(f64));
+                        running = false;
+                        break;
+                    }
+                    u64 result_slot = base - return_arg_count(curr);
+                    if (result_slot != sp - 1) {
+                        memcpy(SLOT(result_slot), result, lanes * sizeof(f64));
+                    }
+                    sp = result_slot + 1;
+
+                    BatchFrame frame = dynarray_pop(&ctx->batch_frames);
+                    base = frame.base;
+                    pc = frame.return_address;
+                } break;
+                case BYTECODE_PUSH_ARG: {
+                    assert(sp < BATCH_STACK_SLOTS);
+                    memcpy(SLOT(sp), SLOT(base - 1 - curr->imm.u), lanes * sizeof(f64));
+                    sp += 1;
+                    pc += 1;
+                } break;
+                case BYTECODE_PUSH_LOCAL: {
+                    assert(sp < BATCH_STACK_SLOTS);
+                    memcpy(SLOT(sp), SLOT(base + curr->imm.u), lanes * sizeof(f64));
+                    sp += 1;
+                    pc += 1;
+                } break;
+                case BYTECODE_PUSH: {
+                    assert(sp < BATCH_STACK_SLOTS);
+                    f64 *dst = SLOT(sp);
+                    for (u64 i = 0; i < lanes; ++i) {
+                        dst[i] = curr->imm.f;
+                    }
+                    sp += 1;
+                    pc += 1;
+                } break;
+                case BYTECODE_PUSH_GLOBAL: {
+                    assert(sp < BATCH_STACK_SLOTS);
+                    f64 *dst = SLOT(sp);
+                    f64 value = program->globals.dat[curr->imm.u].f;
+                    for (u64 i = 0; i < lanes; ++i) {
+                        dst[i] = value;
+                    }
+                    sp += 1;
+                    pc += 1;
+                } break;
+                case BYTECODE_NEG: {
+                    assert(sp >= 1);
+                    simd_kernels.neg(SLOT(sp - 1), SLOT(sp - 1), lanes);
+                    pc += 1;
+                } break;
+                case BYTECODE_ADD: {
+                    assert(sp >= 2);
+                    simd_kernels.add(SLOT(sp - 2), SLOT(sp - 1), SLOT(sp - 2), lanes);
+                    sp -= 1;
+                    pc += 1;
+                } break;
+                case BYTECODE_SUB: {
+                    assert(sp >= 2);
+                    simd_kernels.sub(SLOT(sp - 2), SLOT(sp - 1), SLOT(sp - 2), lanes);
+                    sp -= 1;
+                    pc += 1;
+                } break;
+                case BYTECODE_MUL: {
+                    assert(sp >= 2);
+                    simd_kernels.mul(SLOT(sp - 2), SLOT(sp - 1), SLOT(sp - 2), lanes);
+                    sp -= 1;
+                    pc += 1;
+                } break;
+                case BYTECODE_DIV: {
+                    assert(sp >= 2);
+                    simd_kernels.div(SLOT(sp - 2), SLOT(sp - 1), SLOT(sp - 2), lanes);
+                    sp -= 1;
+                    pc += 1;
+                } break;
+                case BYTECODE_ADD_ARG: {
+                    assert(sp >= 1);
+                    simd_kernels.add(SLOT(sp - 1), SLOT(base - 1 - curr->imm.u), SLOT(sp - 1), lanes);
+                    pc += 1;
+                } break;
+                case BYTECODE_SUB_ARG: {
+                    assert(sp >= 1);
+                    simd_kernels.sub(SLOT(sp - 1), SLOT(base - 1 - curr->imm.u), SLOT(sp - 1), lanes);
+                    pc += 1;
+                } break;
+                case BYTECODE_MUL_ARG: {
+                    assert(sp >= 1);
+                    simd_kernels.mul(SLOT(sp - 1), SLOT(base - 1 - curr->imm.u), SLOT(sp - 1), lanes);
+                    pc += 1;
+                } break;
+                case BYTECODE_DIV_ARG: {
+                    assert(sp >= 1);
+                    simd_kernels.div(SLOT(sp - 1), SLOT(base - 1 - curr->imm.u), SLOT(sp - 1), lanes);
+                    pc += 1;
+                } break;
+                case BYTECODE_ADD_CONST: {
+                    assert(sp >= 1);
+                    for (u64 i = 0; i < lanes; ++i) {
+                        constant[i] = curr->imm.f;
+                    }
+                    simd_kernels.add(SLOT(sp - 1), SLOT(sp - 1), constant, lanes);
+                    pc += 1;
+                } break;
+                case BYTECODE_SUB_CONST: {
+                    assert(sp >= 1);
+                    for (u64 i = 0; i < lanes; ++i) {
+                        constant[i] = curr->imm.f;
+                    }
+                    simd_kernels.sub(SLOT(sp - 1), SLOT(sp - 1), constant, lanes);
+                    pc += 1;
+                } break;
+                case BYTECODE_MUL_CONST: {
+                    assert(sp >= 1);
+                    for (u64 i = 0; i < lanes; ++i) {
+                        constant[i] = curr->imm.f;
+                    }
+                    simd_kernels.mul(SLOT(sp - 1), SLOT(sp - 1), constant, lanes);
+                    pc += 1;
+                } break;
+                case BYTECODE_DIV_CONST: {
+                    assert(sp >= 1);
+                    for (u64 i = 0; i < lanes; ++i) {
+                        constant[i] = curr->imm.f;
+                    }
+                    simd_kernels.div(SLOT(sp - 1), SLOT(sp - 1), constant, lanes);
+                    pc += 1;
+                } break;
+                case BYTECODE_MULADD: {
+                    assert(sp >= 3);
+                    simd_kernels.mul(SLOT(sp - 2), SLOT(sp - 1), SLOT(sp - 2), lanes);
+                    simd_kernels.add(SLOT(sp - 3), SLOT(sp - 2), SLOT(sp - 3), lanes);
+                    sp -= 2;
+                    pc += 1;
+                } break;
+                case BYTECODE_ADDADD: {
+                    assert(sp >= 3);
+                    simd_kernels.add(SLOT(sp - 2), SLOT(sp - 1), SLOT(sp - 2), lanes);
+                    simd_kernels.add(SLOT(sp - 3), SLOT(sp - 2), SLOT(sp - 3), lanes);
+                    sp -= 2;
+                    pc += 1;
+                } break;
+                case BytecodeType_COUNT: assert(false && "unreachable"); break;
+            }
+        }
+    }
+    #undef SLOT
+
+    return EXECUTE_DONE;
+}
+
+ExecuteStatus execute_program_batch(Program *program, ExecutionContext *ctx, String func, f64 **arg_columns, u64 func_args_count, f64 *results, u64 count) {
+    return execute_program_batch_handle(program, ctx, get_function_handle(program, func), arg_columns, func_args_count, results, count);
+}
+
+// preallocates stack_slots stack values and registers, call before handing ctx to another thread
+void execution_context_init(ExecutionContext *ctx, u64 stack_slots) {
+    *ctx = {};
+    dynarray_init(&ctx->stack, stack_slots);
+    dynarray_init(&ctx->registers, stack_slots);
+    // the kernels are picked once, not racing on it from every thread
+    if (!simd_kernels.add) simd_init();
+}
+
+// blocks of BATCH_LANES in one pool_parallel_for chunk, enough that running it outweighs stealing it
+#define BATCH_CHUNK_BLOCKS 16
+
+struct BatchJob {
+    Program *program;
+    // indexed by PoolWorker::index
+    ExecutionContext *contexts;
+    FunctionHandle handle;
+    f64 **arg_columns;
+    u64 func_args_count;
+    f64 *results;
+    u64 count;
+
+    // the first chunk that does not finish stores its status and error, the rest are skipped
+    volatile u32 failed;
+    ExecuteStatus status;
+    Error error;
+};
+
+// begin and end count blocks so only the last chunk has a partial block
+void batch_chunk(PoolWorker *worker, void *data, u64 begin_block, u64 end_block) {
+    BatchJob *job = (BatchJob *)data;
+    if (atomic_load(&job->failed)) return;
+    u64 begin = begin_block * BATCH_LANES;
+    u64 end = end_block * BATCH_LANES;
+    if (end > job->count) end = job->count;
+
+    u64 pos = arena_get_pos(&worker->scratch);
+    f64 **columns = (f64 **)arena_alloc(&worker->scratch, job->func_args_count * sizeof(f64 *));
+    for (u64 i = 0; i < job->func_args_count; ++i) {
+        columns[i] = job->arg_columns[i] + begin;
+    }
+    ExecutionContext *ctx = job->contexts + worker->index;
+    ExecuteStatus status = execute_program_batch_handle(job->program, ctx, job->handle, columns, job->func_args_count, job->results + begin, end - begin);
+    arena_set_pos(&worker->scratch, pos);
+
+    if (status != EXECUTE_DONE && atomic_exchange(&job->failed, 1) == 0) {
+        job->status = status;
+        job->error = ctx->error;
+    }
+}
+
+bool execute_batch(Interpreter *inter, String func, f64 **arg_columns, u64 func_args_count, f64 *results, u64 count) {
+    if (inter->errors.count > 0) return false;
+    if (!inter->pool || count <= BATCH_CHUNK_BLOCKS * BATCH_LANES) {
+        ExecuteStatus status = execute_program_batch(&inter->program, &inter->exec, func, arg_columns, func_args_count, results, count);
+        if (status == EXECUTE_ERROR) dynarray_append(&inter->errors, inter->exec.error);
+        return status == EXECUTE_DONE;
+    }
+
+    while (inter->pool_exec.count < inter->pool->worker_count) {
+        ExecutionContext ctx = {};
+        execution_context_init(&ctx, 0);
+        dynarray_append(&inter->pool_exec, ctx);
+    }
+    for (u64 i = 0; i < inter->pool_exec.count; ++i) {
+        inter->pool_exec.dat[i].max_call_depth = inter->exec.max_call_depth;
+    }
+    BatchJob job = {};
+    job.program = &inter->program;
+    job.contexts = inter->pool_exec.dat;
+    job.handle = get_function_handle(&inter->program, func);
+    job.arg_columns = arg_columns;
+    job.func_args_count = func_args_count;
+    job.results = results;
+    job.count = count;
+    job.status = EXECUTE_DONE;
+
+    PoolWorker *worker = pool_enter(inter->pool);
+    pool_parallel_for(worker, (count + BATCH_LANES - 1) / BATCH_LANES, BATCH_CHUNK_BLOCKS, batch_chunk, &job);
+    pool_leave(worker);
+
+    if (job.status == EXECUTE_ERROR) dynarray_append(&inter->errors, job.error);
+    return job.status == EXECUTE_DONE;
+}
+
+void execution_context_free(ExecutionContext *ctx) {
+    ctx->stack.count = 0;
+    ctx->frames.count = 0;
+    ctx->registers.count = 0;
+    ctx->reg_frames.count = 0;
+    ctx->batch_stack.count = 0;
+    ctx->batch_frames.count = 0;
+    ctx->jit_args.count = 0;
+    dynarray_shrink(&ctx->stack);
+    dynarray_shrink(&ctx->frames);
+    dynarray_shrink(&ctx->registers);
+    dynarray_shrink(&ctx->reg_frames);
+    dynarray_shrink(&ctx->batch_stack);
+    dynarray_shrink(&ctx->batch_frames);
+    dynarray_shrink(&ctx->jit_args);
+}
+
+u64 hash_definition(Interpreter *inter, u64 statement_index);
+
+u64 hash_tree(Interpreter *inter, Node *n, u64 h) {
+    h = hash_combine(h, (u64)n->type);
+    switch (n->type) {
+        case NODE_NUMBER: {
+            StackData sd = {};
+            sd.f = n->number;
+            h = hash_combine(h, sd.u);
+        } break;
+        case NODE_VARIABLE: {
+            Item *item = find_item(n->scope, n->name_id);
+            assert(item);
+            if (item->type == ITEM_GLOBALVARIABLE) {
+                h = hash_combine(h, hash_definition(inter, inter->global_statements.dat[item->id]));
+            } else {
+                h = hash_combine(h, item->id);
+            }
+        } break;
+        case NODE_FUNCTION: {
+            Item *item = find_item(n->scope, n->name_id);
+            assert(item);
+            h = hash_combine(h, hash_definition(inter, item->id));
+        } break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_DIV:
+        case NODE_UNARYADD:
+        case NODE_UNARYSUB: {
+            // the type and the children are the whole node
+        } break;
+        // only expressions are walked
+        case NODE_INVALID:
+        case NODE_PROGRAM:
+        case NODE_STATEMENT:
+        case NODE_FUNCTIONDEF:
+        case NODE_VARIABLEDEF:
+        case NODE_OPENPAREN:
+        case NodeType_COUNT: assert(false && "unreachable"); break;
+    }
+    for (u64 i = 0; i < n->node_count; ++i) {
+        h = hash_tree(inter, n->nodes[i], h);
+    }
+    return h;
+}
+
+// hash of a definition together with every definition it uses
+u64 hash_definition(Interpreter *inter, u64 statement_index) {
+    DefinitionState *state = inter->definition_states.dat + statement_index;
+    Node *def = get_definition(inter, statement_index);
+    u64 h = string_hash(def->text);
+
+    if (state->hash_state == VISIT_DONE) return state->hash;
+    // recursive definitions only contribute their name
+    if (state->hash_state == VISIT_ACTIVE) return h;
+
+    state->hash_state = VISIT_ACTIVE;
+    h = hash_combine(h, def->node_count - 1);
+    h = hash_tree(inter, def->nodes[def->node_count - 1], h);
+    state->hash = h;
+    state->hash_state = VISIT_DONE;
+    return h;
+}
+
+u64 key_definition_index(Interpreter *inter, u64 statement_index, DynArray<u64> *defs) {
+    DefinitionState *state = inter->definition_states.dat + statement_index;
+    if (state->key_mark != inter->walk_mark) {
+        state->key_mark = inter->walk_mark;
+        state->key_index = defs->count;
+        dynarray_append(defs, statement_index);
+    }
+    return state->key_index;
+}
+
+void key_tree(Interpreter *inter, Node *n, DynArray<u64> *key, DynArray<u64> *defs) {
+    dynarray_append(key, (u64)n->type);
+    dynarray_append(key, n->node_count);
+    switch (n->type) {
+        case NODE_NUMBER: {
+            StackData sd = {};
+            sd.f = n->number;
+            dynarray_append(key, sd.u);
+        } break;
+        case NODE_VARIABLE: {
+            Item *item = find_item(n->scope, n->name_id);
+            assert(item);
+            dynarray_append(key, (u64)item->type);
+            if (item->type == ITEM_GLOBALVARIABLE) {
+                dynarray_append(key, key_definition_index(inter, inter->global_statements.dat[item->id], defs));
+            } else {
+                dynarray_append(key, item->id);
+            }
+        } break;
+        case NODE_FUNCTION: {
+            Item *item = find_item(n->scope, n->name_id);
+            assert(item);
+            dynarray_append(key, key_definition_index(inter, item->id, defs));
+        } break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_DIV:
+        case NODE_UNARYADD:
+        case NODE_UNARYSUB: {
+            // the type and the children are the whole node
+        } break;
+        // only expressions are walked
+        case NODE_INVALID:
+        case NODE_PROGRAM:
+        case NODE_STATEMENT:
+        case NODE_FUNCTIONDEF:
+        case NODE_VARIABLEDEF:
+        case NODE_OPENPAREN:
+        case NodeType_COUNT: assert(false && "unreachable"); break;
+    }
+    for (u64 i = 0; i < n->node_count; ++i) {
+        key_tree(inter, n->nodes[i], key, defs);
+    }
+}
+
+// appends what hash_definition combines, with the definitions it uses numbered in the order they
+// are first reached instead of hashed. Two definitions with the same key compute the same value
+void definition_key(Interpreter *inter, u64 statement_index, DynArray<u64> *key) {
+    DynArray<u64> defs = {};
+    dynarray_init_arena(&defs, &inter->func_arena);
+    inter->walk_mark += 1;
+    key_definition_index(inter, statement_index, &defs);
+    for (u64 i = 0; i < defs.count; ++i) {
+        Node *def = get_definition(inter, defs.dat[i]);
+        dynarray_append(key, def->node_count - 1);
+        key_tree(inter, def->nodes[def->node_count - 1], key, &defs);
+    }
+}
+
+void append_global_cache(Interpreter *inter, u64 statement_index, u64 hash, StackData value) {
+    GlobalCacheEntry entry = {};
+    entry.hash = hash;
+    entry.value = value;
+    entry.key_start = inter->global_keys_next.count;
+    definition_key(inter, statement_index, &inter->global_keys_next);
+    entry.key_count = inter->global_keys_next.count - entry.key_start;
+    dynarray_append(&inter->global_cache_next, entry);
+}
+
+// empties the cache of this compile and indexes the one of the previous compile
+void begin_global_cache(Interpreter *inter) {
+    inter->global_cache_next.count = 0;
+    inter->global_keys_next.count = 0;
+    DynArray<u32> *table = &inter->global_cache_table;
+    u64 cap = next_power_of_two(inter->global_cache.count * 2 + 1);
+    table->count = 0;
+    dynarray_reserve(table, cap);
+    table->count = cap;
+    memset(table->dat, 0, cap * sizeof(u32));
+    for (u64 i = 0; i < inter->global_cache.count; ++i) {
+        u64 slot = inter->global_cache.dat[i].hash & (cap - 1);
+        while (table->dat[slot] != 0) slot = (slot + 1) & (cap - 1);
+        table->dat[slot] = (u32)(i + 1);
+    }
+}
+
+// the cache of this compile is the one of the previous compile for the next
+void end_global_cache(Interpreter *inter) {
+    DynArray<GlobalCacheEntry> tmp = inter->global_cache;
+    inter->global_cache = inter->global_cache_next;
+    inter->global_cache_next = tmp;
+    DynArray<u64> tmp_keys = inter->global_keys;
+    inter->global_keys = inter->global_keys_next;
+    inter->global_keys_next = tmp_keys;
+}
+
+// the entry of the previous compile with the hash of the definition, confirmed by its key so
+// hashes that collide miss
+GlobalCacheEntry *find_global_cache(Interpreter *inter, u64 statement_index, u64 hash) {
+    DynArray<u32> *table = &inter->global_cache_table;
+    DynArray<u64> key = {};
+    dynarray_init_arena(&key, &inter->func_arena);
+    bool has_key = false;
+    for (u64 slot = hash & (table->count - 1); table->dat[slot] != 0; slot = (slot + 1) & (table->count - 1)) {
+        GlobalCacheEntry *entry = inter->global_cache.dat + table->dat[slot] - 1;
+        if (entry->hash != hash) continue;
+        if (!has_key) {
+            definition_key(inter, statement_index, &key);
+            has_key = true;
+        }
+        if (entry->key_count == key.count && memcmp(inter->global_keys.dat + entry->key_start, key.dat, key.count * sizeof(u64)) == 0) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+struct EvalPlan;
+
+// one statement to execute once the globals it reads have values
+struct EvalTask {
+    u64 statement_index;
+    bool is_global;
+    u64 global_id;
+    StackData value;
+
+    // tasks of globals it reads that have not finished yet
+    volatile u32 pending;
+    // tasks reading the global this one computes, EvalPlan::dependents[dependent_start..]
+    u64 dependent_start;
+    u64 dependent_count;
+
+    EvalPlan *plan;
+};
+
+struct EvalEdge {
+    u64 task;
+    u64 reader;
+};
+
+// statements that have to be executed, every global comes before the tasks reading it
+struct EvalPlan {
+    DynArray<EvalTask> tasks;
+    // global ids found by the walk of the statements being planned, used as a stack
+    DynArray<u64> reads;
+    DynArray<EvalEdge> edges;
+    u64 *dependents;
+
+    Program *program;
+    // indexed by PoolWorker::index
+    ExecutionContext *contexts;
+    VmMode vm_mode;
+    TaskGroup group;
+
+    // the first task that does not finish stores its context, the rest are skipped
+    volatile u32 failed;
+    ExecuteStatus status;
+    Error error;
+};
+
+bool plan_global(Interpreter *inter, EvalPlan *plan, u64 global_id);
+
+// plans every global used by n, directly or through the functions it calls, and pushes their ids
+// on plan->reads
+bool plan_global_dependencies(Interpreter *inter, EvalPlan *plan, Node *n, u64 walk_mark) {
+    if (n->type == NODE_VARIABLE) {
+        Item *item = find_item(n->scope, n->name_id);
+        assert(item);
+        if (item->type == ITEM_GLOBALVARIABLE) {
+            if (!plan_global(inter, plan, item->id)) return false;
+            dynarray_append(&plan->reads, item->id);
+        }
+    } else if (n->type == NODE_FUNCTION) {
+        Item *item = find_item(n->scope, n->name_id);
+        assert(item);
+        DefinitionState *state = inter->definition_states.dat + item->id;
+        if (state->walk_mark != walk_mark) {
+            state->walk_mark = walk_mark;
+            Node *def = get_definition(inter, item->id);
+            if (!plan_global_dependencies(inter, plan, def->nodes[def->node_count - 1], walk_mark)) return false;
+        }
+    }
+    for (u64 i = 0; i < n->node_count; ++i) {
+        if (!plan_global_dependencies(inter, plan, n->nodes[i], walk_mark)) return false;
+    }
+    return true;
+}
+
+// adds the task of a statement that reads the globals in plan->reads[reads_start..] and pops them
+void add_eval_task(Interpreter *inter, EvalPlan *plan, u64 statement_index, u64 reads_start, bool is_global, u64 global_id) {
+    EvalTask task = {};
+    task.statement_index = statement_index;
+    task.is_global = is_global;
+    task.global_id = global_id;
+    task.plan = plan;
+    u64 task_index = plan->tasks.count;
+    for (u64 i = reads_start; i < plan->reads.count; ++i) {
+        u64 read_statement = inter->global_statements.dat[plan->reads.dat[i]];
+        u64 read_task = inter->definition_states.dat[read_statement].eval_task;
+        // globals that already have a value do not hold anything up
+        if (read_task == 0) continue;
+        dynarray_append(&plan->edges, EvalEdge {read_task - 1, task_index});
+        task.pending += 1;
+    }
+    plan->reads.count = reads_start;
+
+    dynarray_append(&plan->tasks, task);
+    inter->definition_states.dat[statement_index].eval_task = task_index + 1;
+}
+
+// globals whose definition and dependencies are unchanged since the last compile get their
+// value from the cache, the others a task after the tasks of the globals they read
+bool plan_global(Interpreter *inter, EvalPlan *plan, u64 global_id) {
+    u64 statement_index = inter->global_statements.dat[global_id];
+    DefinitionState *state = inter->definition_states.dat + statement_index;
+    Node *def = get_definition(inter, statement_index);
+
+    if (state->eval_state == VISIT_DONE) return true;
+    if (state->eval_state == VISIT_ACTIVE) {
+        Error err = {};
+        err.err_string = str_lit("Global variable depends on itself");
+        err.token_id = def->token_index;
+        err.has_token = true;
+        err.statement_id = statement_index;
+        err.has_statement = true;
+        dynarray_append(&inter->errors, err);
+        return false;
+    }
+    state->eval_state = VISIT_ACTIVE;
+
+    u64 reads_start = plan->reads.count;
+    inter->walk_mark += 1;
+    if (!plan_global_dependencies(inter, plan, def->nodes[0], inter->walk_mark)) return false;
+
+    u64 hash = hash_definition(inter, statement_index);
+    GlobalCacheEntry *entry = find_global_cache(inter, statement_index, hash);
+    if (entry) {
+        plan->reads.count = reads_start;
+        inter->program.globals.dat[global_id] = entry->value;
+        append_global_cache(inter, statement_index, hash, entry->value);
+        state->eval_state = VISIT_DONE;
+        return true;
+    }
+
+    add_eval_task(inter, plan, statement_index, reads_start, true, global_id);
+    state->eval_state = VISIT_DONE;
+    return true;
+}
+
+void eval_plan_init(EvalPlan *plan, Interpreter *inter) {
+    *plan = {};
+    dynarray_init_arena(&plan->tasks, &inter->func_arena);
+    dynarray_init_arena(&plan->reads, &inter->func_arena);
+    dynarray_init_arena(&plan->edges, &inter->func_arena);
+}
+
+// false when the task failed or was skipped after another one did
+bool run_eval_task(EvalPlan *plan, ExecutionContext *ctx, EvalTask *task) {
+    if (atomic_load(&plan->failed)) return false;
+    if (!execute_program_handle(plan->program, ctx, plan->vm_mode, task->statement_index, nullptr, 0)) {
+        if (atomic_exchange(&plan->failed, 1) == 0) {
+            plan->status = ctx->status;
+            plan->error = ctx->error;
+        }
+        return false;
+    }
+    task->value = dynarray_pop(&ctx->stack);
+    // no task reading it has started, they wait on pending
+    if (task->is_global) plan->program->globals.dat[task->global_id] = task->value;
+    return true;
+}
+
+void eval_task(PoolWorker *worker, void *data, u64, u64) {
+    EvalTask *task = (EvalTask *)data;
+    EvalPlan *plan = task->plan;
+    if (!run_eval_task(plan, plan->contexts + worker->index, task)) return;
+    for (u64 i = 0; i < task->dependent_count; ++i) {
+        EvalTask *reader = plan->tasks.dat + plan->dependents[task->dependent_start + i];
+        if (atomic_add(&reader->pending, (u32)-1) == 1) pool_spawn(worker, &plan->group, eval_task, reader);
+    }
+}
+
+// executes the planned tasks, statements that do not depend on each other run on different
+// workers of the pool when the interpreter has one. Returns false on an error or when cancelled
+bool run_eval_plan(Interpreter *inter, EvalPlan *plan) {
+    plan->program = &inter->program;
+    plan->vm_mode = inter->vm_mode;
+    plan->status = EXECUTE_DONE;
+
+    // one Samples can only be written by one thread
+    if (!inter->pool || plan->tasks.count < 2 || inter->samples) {
+        inter->exec.cancel = inter->cancel;
+        inter->exec.samples = inter->samples;
+        // planned in an order where every global comes before its readers
+        for (u64 i = 0; i < plan->tasks.count; ++i) {
+            if (!run_eval_task(plan, &inter->exec, plan->tasks.dat + i)) break;
+        }
+        inter->exec.samples = nullptr;
+    } else {
+        // readers of every task in the order of the tasks
+        u64 *dependents = (u64 *)arena_alloc(&inter->func_arena, (plan->edges.count + 1) * sizeof(u64));
+        for (u64 i = 0; i < plan->edges.count; ++i) {
+            plan->tasks.dat[plan->edges.dat[i].task].dependent_count += 1;
+        }
+        u64 start = 0;
+        for (u64 i = 0; i < plan->tasks.count; ++i) {
+            EvalTask *task = plan->tasks.dat + i;
+            task->dependent_start = start;
+            start += task->dependent_count;
+            task->dependent_count = 0;
+        }
+        for (u64 i = 0; i < plan->edges.count; ++i) {
+            EvalTask *task = plan->tasks.dat + plan->edges.dat[i].task;
+            dependents[task->dependent_start + task->dependent_count++] = plan->edges.dat[i].reader;
+        }
+        plan->dependents = dependents;
+
+        while (inter->pool_exec.count < inter->pool->worker_count) {
+            ExecutionContext ctx = {};
+            execution_context_init(&ctx, 1 << 10);
+            dynarray_append(&inter->pool_exec, ctx);
+        }
+        for (u64 i = 0; i < inter->pool_exec.count; ++i) {
+            inter->pool_exec.dat[i].cancel = inter->cancel;
+            inter->pool_exec.dat[i].max_call_depth = inter->exec.max_call_depth;
+        }
+        plan->contexts = inter->pool_exec.dat;
+
+        PoolWorker *worker = pool_enter(inter->pool);
+        for (u64 i = 0; i < plan->tasks.count; ++i) {
+            EvalTask *task = plan->tasks.dat + i;
+            if (task->pending == 0) pool_spawn(worker, &plan->group, eval_task, task);
+        }
+        pool_wait(worker, &plan->group);
+        pool_leave(worker);
+    }
+
+    if (plan->failed) {
+        if (plan->status == EXECUTE_ERROR) dynarray_append(&inter->errors, plan->error);
+        return false;
+    }
+    for (u64 i = 0; i < plan->tasks.count; ++i) {
+        EvalTask *task = plan->tasks.dat + i;
+        if (!task->is_global) continue;
+        u64 hash = inter->definition_states.dat[task->statement_index].hash;
+        append_global_cache(inter, task->statement_index, hash, task->value);
+    }
+    return true;
+}
+
+// evaluates every global variable once, values whose definition and dependencies are unchanged
+// since the last compile are taken from the cache
+void evaluate_globals(Interpreter *inter) {
+    inter->definition_states.count = 0;
+    for (u64 i = 0; i < inter->ctx.root->node_count; ++i) {
+        dynarray_append(&inter->definition_states, {});
+    }
+
+    inter->program.globals.count = 0;
+    for (u64 i = 0; i < inter->global_statements.count; ++i) {
+        dynarray_append(&inter->program.globals, {});
+    }
+
+    begin_global_cache(inter);
+    EvalPlan plan = {};
+    eval_plan_init(&plan, inter);
+    for (u64 i = 0; i < inter->global_statements.count; ++i) {
+        if (!plan_global(inter, &plan, i)) return;
+    }
+    if (!run_eval_plan(inter, &plan)) return;
+    end_global_cache(inter);
+}
+
+void reset_front_end(Interpreter *inter) {
+    inter->src = {};
+    dynarray_init_arena(&inter->lex.tokens, &inter->ctx.node_arena);
+    inter->lex.iter = 0;
+
+    dynarray_init_arena(&inter->ctx.node_stack, &inter->ctx.node_arena);
+    dynarray_init_arena(&inter->ctx.op_stack, &inter->ctx.node_arena);
+    inter->ctx.iter = 0;
+    inter->ctx.root = nullptr;
+}
+
+// clears everything built from the whole program, the parsed units are kept
+void reset_program(Interpreter *inter) {
+    arena_clear(&inter->func_arena);
+    inter->ctx.root = nullptr;
+    inter->program_scope = {};
+
+    dynarray_init_arena(&inter->program.bytecode, &inter->func_arena);
+    dynarray_init_arena(&inter->program.source_map, &inter->func_arena);
+    dynarray_init_arena(&inter->program.symbol_ids, &inter->func_arena);
+    dynarray_init_arena(&inter->program.symbols, &inter->func_arena);
+    dynarray_init_arena(&inter->program.symbol_arg_counts, &inter->func_arena);
+    inter->program.symbol_map = {};
+    dynarray_init_arena(&inter->program.stack_depths, &inter->func_arena);
+    inter->program.max_stack_depth = 0;
+    dynarray_init_arena(&inter->program.reg_bytecode, &inter->func_arena);
+    dynarray_init_arena(&inter->program.reg_symbol_ids, &inter->func_arena);
+    dynarray_init_arena(&inter->program.reg_frame_sizes, &inter->func_arena);
+    dynarray_init_arena(&inter->program.threaded_code, &inter->func_arena);
+    dynarray_init_arena(&inter->program.compact_code, &inter->func_arena);
+    dynarray_init_arena(&inter->program.constants, &inter->func_arena);
+    dynarray_init_arena(&inter->program.compact_symbol_ids, &inter->func_arena);
+    dynarray_init_arena(&inter->program.jit_offsets, &inter->func_arena);
+    inter->program.has_jit = false;
+    inter->inlined_calls = 0;
+    // the memory of ir is kept
+    inter->ir.insts.count = 0;
+    inter->ir.call_args.count = 0;
+    inter->ir.functions.count = 0;
+    memset(inter->ir.passes, 0, sizeof(inter->ir.passes));
+    dynarray_init_arena(&inter->program.globals, &inter->func_arena);
+    dynarray_init_arena(&inter->global_statements, &inter->func_arena);
+    dynarray_init_arena(&inter->definition_states, &inter->func_arena);
+    dynarray_init_arena(&inter->errors, &inter->func_arena);
+
+    // the memory of exec is kept
+    inter->exec.status = EXECUTE_IDLE;
+    inter->exec.base_stackframe_index = 0;
+    inter->exec.stack.count = 0;
+    inter->exec.frames.count = 0;
+    inter->exec.reg_frames.count = 0;
+    inter->exec.batch_frames.count = 0;
+}
+
+void reset_interpreter(Interpreter *inter) {
+    // everything a compile produces lives in the two arenas
+    arena_clear(&inter->ctx.node_arena);
+    reset_front_end(inter);
+
+    interner_clear(&inter->interner);
+    // the name ids of parsed units came from the interner
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        inter->units.dat[i].changed = true;
+    }
+
+    reset_program(inter);
+}
+
+
+// time of a phase adds up over the units of compile_units
+void end_phase(Interpreter *inter, CompilePhase phase, f64 start) {
+    inter->metrics.phase_seconds[phase] += time_seconds() - start;
+}
+
+typedef void (*CompilePhaseProc)(Interpreter *inter);
+
+void run_phase(Interpreter *inter, CompilePhase phase, CompilePhaseProc proc) {
+    if (inter->errors.count > 0) return;
+    f64 start = time_seconds();
+    proc(inter);
+    end_phase(inter, phase, start);
+}
+
+// returns the start time for end_metrics
+f64 begin_metrics(Interpreter *inter) {
+    CompileMetrics *m = &inter->metrics;
+    memset(m->phase_seconds, 0, sizeof(m->phase_seconds));
+    m->units_parsed = 0;
+    return time_seconds();
+}
+
+// tokens and nodes are filled in by the caller
+void end_metrics(Interpreter *inter, f64 start) {
+    CompileMetrics *m = &inter->metrics;
+    m->total_seconds = time_seconds() - start;
+    m->compiles += 1;
+
+    m->scope_items = 0;
+    Node *prog = inter->ctx.root;
+    if (prog && prog->scope) {
+        m->scope_items = prog->scope->count;
+        for (u64 i = 0; i < prog->node_count; ++i) {
+            Node *inner = prog->nodes[i]->nodes[0];
+            if (inner->type == NODE_FUNCTIONDEF && inner->scope) m->scope_items += inner->scope->count;
+        }
+    }
+
+    Program *program = &inter->program;
+    m->bytecode_count = program->bytecode.count;
+    m->bytecode_bytes = program->bytecode.count * sizeof(*program->bytecode.dat);
+    m->compact_bytes = program->compact_code.count + program->constants.count * sizeof(*program->constants.dat);
+    m->func_arena_bytes = arena_get_pos(&inter->func_arena);
+    m->node_arena_bytes = arena_get_pos(&inter->ctx.node_arena);
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        m->node_arena_bytes += arena_get_pos(&inter->units.dat[i].arena);
+    }
+}
+
+void compile(Interpreter *inter, String src) {
+    f64 start = begin_metrics(inter);
+    f64 phase_start = time_seconds();
+    tokenize(inter, src);
+    end_phase(inter, PHASE_TOKENIZE, phase_start);
+    run_phase(inter, PHASE_PARSE, parse);
+    inter->metrics.tokens = inter->lex.tokens.count;
+    inter->metrics.nodes = inter->ctx.root ? count_nodes(inter->ctx.root) : 0;
+    run_phase(inter, PHASE_GRAPHVIZ, graphviz_out);
+    run_phase(inter, PHASE_TYPECHECK, typecheck_tree);
+    run_phase(inter, PHASE_FOLD, fold_tree);
+    run_phase(inter, PHASE_INLINE, inline_tree);
+    run_phase(inter, PHASE_CSE, cse_tree);
+    run_phase(inter, PHASE_BYTECODE, bytecode_from_tree);
+    run_phase(inter, PHASE_EVALUATE, evaluate_globals);
+    inter->metrics.inlined_calls = inter->inlined_calls;
+    end_metrics(inter, start);
+}
+
+// records the program level names n reads, parameters of def are not
+void collect_reads(Interpreter *inter, Unit *u, Node *n, Node *def) {
+    if (n->type == NODE_FUNCTION || n->type == NODE_VARIABLE) {
+        bool is_param = false;
+        if (def->type == NODE_FUNCTIONDEF) {
+            for (u64 i = 0; i < def->node_count - 1; ++i) {
+                if (string_equal(def->nodes[i]->text, n->text)) is_param = true;
+            }
+        }
+        if (!is_param) dynarray_append(&u->reads, intern(&inter->interner, n->text));
+    }
+    for (u64 i = 0; i < n->node_count; ++i) {
+        collect_reads(inter, u, n->nodes[i], def);
+    }
+}
+
+// lexes and parses the text of u into its own arena
+void parse_unit(Interpreter *inter, Unit *u) {
+    // generous bound on tokens, nodes and scopes per character, inlining stops when it runs out
+    u64 capacity = 4096 + u->text.count * 1024;
+    if (u->arena.max_capacity < capacity) {
+        arena_clean(&u->arena);
+        arena_init(&u->arena, capacity);
+    }
+    arena_clear(&u->arena);
+    u->statements.count = 0;
+    u->errors.count = 0;
+    u->results.count = 0;
+    u->defines.count = 0;
+    u->reads.count = 0;
+    u->token_count = 0;
+    u->node_count = 0;
+    u->inlined_calls = 0;
+    u->changed = false;
+    u->stage = UNIT_PARSED;
+    u->stale = true;
+    if (u->text.count == 0) return;
+
+    // the lexer and parser work on the interpreter, lend them the arena and errors of the unit
+    Arena node_arena = inter->ctx.node_arena;
+    DynArray<Error> errors = inter->errors;
+    inter->ctx.node_arena = u->arena;
+    inter->errors = u->errors;
+    reset_front_end(inter);
+
+    f64 start = time_seconds();
+    tokenize(inter, String {u->text.dat, u->text.count});
+    end_phase(inter, PHASE_TOKENIZE, start);
+    run_phase(inter, PHASE_PARSE, parse);
+    inter->metrics.units_parsed += 1;
+    u->token_count = inter->lex.tokens.count;
+    if (inter->errors.count == 0) {
+        Node *prog = inter->ctx.root;
+        for (u64 i = 0; i < prog->node_count; ++i) {
+            dynarray_append(&u->statements, prog->nodes[i]);
+            dynarray_append(&u->results, {});
+            u->node_count += count_nodes(prog->nodes[i]);
+        }
+    }
+
+    u->arena = inter->ctx.node_arena;
+    u->errors = inter->errors;
+    inter->ctx.node_arena = node_arena;
+    inter->errors = errors;
+    reset_front_end(inter);
+
+    for (u64 i = 0; i < u->statements.count; ++i) {
+        Node *inner = u->statements.dat[i]->nodes[0];
+        if (inner->type == NODE_FUNCTIONDEF || inner->type == NODE_VARIABLEDEF) {
+            dynarray_append(&u->defines, intern(&inter->interner, inner->text));
+        }
+        collect_reads(inter, u, inner, inner);
+    }
+}
+
+// a statement terminator is added since every text box holds whole statements
+void set_unit_text(Interpreter *inter, u64 unit_index, String text) {
+    while (inter->units.count <= unit_index) {
+        Unit u = {};
+        u.changed = true;
+        dynarray_append(&inter->units, u);
+    }
+    Unit *u = inter->units.dat + unit_index;
+    if (text.count == 0 && u->text.count == 0) return;
+    if (u->text.count == text.count + 1 && memcmp(u->text.dat, text.dat, text.count) == 0) return;
+
+    u->text.count = 0;
+    if (text.count > 0) {
+        string_builder_concat(&u->text, text);
+        string_builder_append(&u->text, ';');
+    }
+    u->changed = true;
+}
+
+// evaluates stale globals and stale expression statements, each as soon as the globals it reads
+// have values, results of everything else are reused
+void evaluate_units(Interpreter *inter) {
+    Node *prog = inter->ctx.root;
+    Unit **statement_units = (Unit **)arena_alloc(&inter->func_arena, prog->node_count * sizeof(Unit *));
+    StatementResult **results = (StatementResult **)arena_alloc(&inter->func_arena, prog->node_count * sizeof(StatementResult *));
+    u64 k = 0;
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        Unit *u = inter->units.dat + i;
+        for (u64 j = 0; j < u->statements.count; ++j) {
+            statement_units[k] = u;
+            results[k] = u->results.dat + j;
+            k += 1;
+        }
+    }
+
+    inter->definition_states.count = 0;
+    for (u64 i = 0; i < prog->node_count; ++i) {
+        DefinitionState state = {};
+        if (!statement_units[i]->stale && results[i]->has_hash) {
+            state.hash_state = VISIT_DONE;
+            state.hash = results[i]->hash;
+        }
+        dynarray_append(&inter->definition_states, state);
+    }
+
+    inter->program.globals.count = 0;
+    for (u64 i = 0; i < inter->global_statements.count; ++i) {
+        u64 statement_index = inter->global_statements.dat[i];
+        StackData value = {};
+        if (!statement_units[statement_index]->stale) {
+            inter->definition_states.dat[statement_index].eval_state = VISIT_DONE;
+            value = results[statement_index]->value;
+        }
+        dynarray_append(&inter->program.globals, value);
+    }
+
+    begin_global_cache(inter);
+    EvalPlan plan = {};
+    eval_plan_init(&plan, inter);
+    for (u64 i = 0; i < inter->global_statements.count; ++i) {
+        u64 statement_index = inter->global_statements.dat[i];
+        if (statement_units[statement_index]->stale) {
+            if (is_cancelled(inter)) return;
+            if (!plan_global(inter, &plan, i)) return;
+        } else if (results[statement_index]->has_hash) {
+            append_global_cache(inter, statement_index, results[statement_index]->hash, inter->program.globals.dat[i]);
+        }
+    }
+    for (u64 i = 0; i < prog->node_count; ++i) {
+        if (!statement_units[i]->stale) continue;
+        Node *inner = prog->nodes[i]->nodes[0];
+        if (inner->type == NODE_FUNCTIONDEF || inner->type == NODE_VARIABLEDEF) continue;
+        u64 reads_start = plan.reads.count;
+        inter->walk_mark += 1;
+        if (!plan_global_dependencies(inter, &plan, inner, inter->walk_mark)) return;
+        add_eval_task(inter, &plan, i, reads_start, false, 0);
+    }
+    if (is_cancelled(inter)) return;
+    if (!run_eval_plan(inter, &plan)) return;
+    end_global_cache(inter);
+
+    for (u64 i = 0; i < prog->node_count; ++i) {
+        if (!statement_units[i]->stale) continue;
+        StatementResult *result = results[i];
+        DefinitionState *state = inter->definition_states.dat + i;
+        result->has_hash = state->hash_state == VISIT_DONE;
+        result->hash = state->hash;
+
+        Node *inner = prog->nodes[i]->nodes[0];
+        if (inner->type == NODE_FUNCTIONDEF) continue;
+        if (inner->type == NODE_VARIABLEDEF) {
+            Item *item = find_item(&inter->program_scope, inner->name_id);
+            // only the first definition of a name gets a value
+            if (get_definition(inter, inter->global_statements.dat[item->id]) != inner) continue;
+            result->value = inter->program.globals.dat[item->id];
+        } else {
+            result->value = plan.tasks.dat[state->eval_task - 1].value;
+        }
+        result->has_value = true;
+    }
+
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        inter->units.dat[i].stale = false;
     }
 }
 
+void compile_units2(Interpreter *inter) {
+    reset_program(inter);
+
+    DynArray<u32> dirty_names = {};
+    dynarray_init_arena(&dirty_names, &inter->func_arena);
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        Unit *u = inter->units.dat + i;
+        if (!u->changed) continue;
+        for (u64 j = 0; j < u->defines.count; ++j) dynarray_append(&dirty_names, u->defines.dat[j]);
+        parse_unit(inter, u);
+        for (u64 j = 0; j < u->defines.count; ++j) dynarray_append(&dirty_names, u->defines.dat[j]);
+    }
 
-bool execute(Interpreter *inter, String func, f64 *args, u64 func_args_count) {
-    if (inter->errors.count > 0) return false;
-    u64 func_id = 0;
-    if (!get_func_id_from_name(inter, func, &func_id)) {
-        return false;
+    // units reading each name, readers[reader_start[id]..reader_start[id + 1]]
+    u64 name_count = inter->interner.entries.count;
+    u64 *reader_start = (u64 *)arena_alloc(&inter->func_arena, (name_count + 2) * sizeof(u64));
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        Unit *u = inter->units.dat + i;
+        for (u64 j = 0; j < u->reads.count; ++j) reader_start[u->reads.dat[j] + 2] += 1;
+    }
+    for (u64 i = 2; i < name_count + 2; ++i) reader_start[i] += reader_start[i - 1];
+    u64 *readers = (u64 *)arena_alloc(&inter->func_arena, (reader_start[name_count + 1] + 1) * sizeof(u64));
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        Unit *u = inter->units.dat + i;
+        for (u64 j = 0; j < u->reads.count; ++j) readers[reader_start[u->reads.dat[j] + 1]++] = i;
     }
 
-    Item *item = find_item_in_scope(func, &inter->ctx.root->scope);
-    if (item) {
-        if (item->func_args != func_args_count) return false;
-    } else {
-        if (func_args_count != 0) return false;
+    bool *name_done = (bool *)arena_alloc(&inter->func_arena, name_count * sizeof(bool));
+    while (dirty_names.count > 0) {
+        u32 name_id = dynarray_pop(&dirty_names);
+        if (name_done[name_id]) continue;
+        name_done[name_id] = true;
+        for (u64 i = reader_start[name_id]; i < reader_start[name_id + 1]; ++i) {
+            Unit *u = inter->units.dat + readers[i];
+            if (u->stage == UNIT_PARSED) continue;
+            // folding rewrote the tree with values of the old definitions, and typechecking again
+            // would put new scopes next to the old ones in the arena of the unit
+            parse_unit(inter, u);
+            u->stage = UNIT_PARSED;
+            u->stale = true;
+            for (u64 j = 0; j < u->defines.count; ++j) dynarray_append(&dirty_names, u->defines.dat[j]);
+        }
     }
 
-    for (u64 j = func_args_count; j-- > 0;) {
-        StackData sd = {};
-        sd.f = args[j];
-        dynarray_append(&inter->stack, sd);
+    u64 statement_count = 0;
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        Unit *u = inter->units.dat + i;
+        statement_count += u->statements.count;
+        for (u64 j = 0; j < u->errors.count; ++j) dynarray_append(&inter->errors, u->errors.dat[j]);
     }
+    if (inter->errors.count > 0) return;
 
+    Node *prog = (Node *)arena_alloc(&inter->func_arena, sizeof(*prog));
+    prog->type = NODE_PROGRAM;
+    prog->node_count = statement_count;
+    prog->nodes = (Node **)arena_alloc(&inter->func_arena, statement_count * sizeof(*prog->nodes));
+    u64 k = 0;
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        Unit *u = inter->units.dat + i;
+        for (u64 j = 0; j < u->statements.count; ++j) prog->nodes[k++] = u->statements.dat[j];
+    }
+    inter->ctx.root = prog;
+    f64 start = time_seconds();
+    build_program_scope(inter, prog, &inter->func_arena);
+
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        Unit *u = inter->units.dat + i;
+        if (u->stage != UNIT_PARSED) continue;
+        if (is_cancelled(inter)) return;
+        // scopes of the definitions live with the nodes of the unit, compile_units never clears
+        // the node arena of the interpreter
+        Arena node_arena = inter->ctx.node_arena;
+        DynArray<Error> errors = inter->errors;
+        inter->ctx.node_arena = u->arena;
+        inter->errors = u->errors;
+        inter->errors.count = 0;
+        for (u64 j = 0; j < u->statements.count; ++j) {
+            typecheck_tree2(inter, u->statements.dat[j], prog->scope);
+        }
+        u->arena = inter->ctx.node_arena;
+        u->errors = inter->errors;
+        inter->ctx.node_arena = node_arena;
+        inter->errors = errors;
+        u->stage = UNIT_TYPECHECKED;
+    }
+    end_phase(inter, PHASE_TYPECHECK, start);
 
-    inter->program_counter = func_id;
-    inter->base_stackframe_index = inter->stack.count;
-    // arg n - 1
-    // arg 1
-    // arg 0
-    // return address
-    // base pointer
-    // stuff
-    while (true) {
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        Unit *u = inter->units.dat + i;
+        for (u64 j = 0; j < u->errors.count; ++j) dynarray_append(&inter->errors, u->errors.dat[j]);
+    }
+    if (inter->errors.count > 0) return;
+
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        Unit *u = inter->units.dat + i;
+        if (u->stage != UNIT_TYPECHECKED) continue;
+        if (is_cancelled(inter)) return;
+        start = time_seconds();
+        for (u64 j = 0; j < u->statements.count; ++j) {
+            fold_tree2(inter, u->statements.dat[j]);
+        }
+        end_phase(inter, PHASE_FOLD, start);
+        // the inlined copies live with the nodes of the unit too
+        Arena node_arena = inter->ctx.node_arena;
+        inter->ctx.node_arena = u->arena;
+        u64 inlined_calls = inter->inlined_calls;
+        start = time_seconds();
+        for (u64 j = 0; j < u->statements.count; ++j) {
+            inline_statement(inter, u->statements.dat[j]);
+        }
+        end_phase(inter, PHASE_INLINE, start);
+        u->inlined_calls = inter->inlined_calls - inlined_calls;
+        u->arena = inter->ctx.node_arena;
+        inter->ctx.node_arena = node_arena;
+        start = time_seconds();
+        for (u64 j = 0; j < u->statements.count; ++j) {
+            cse_statement(inter, u->statements.dat[j]);
+        }
+        end_phase(inter, PHASE_CSE, start);
+        u->stage = UNIT_FOLDED;
+    }
 
-        Bytecode *curr = inter->bytecode.dat + inter->program_counter;
+    run_phase(inter, PHASE_BYTECODE, bytecode_from_tree);
+    run_phase(inter, PHASE_EVALUATE, evaluate_units);
+}
 
-        switch (curr->type) {
+// compiles the units after set_unit_text, only edited units and the units reading what they
+// define are parsed, typechecked, folded and evaluated again. Scopes and bytecode of the
+// whole program are rebuilt, that is linear but cheap next to the front end and evaluation
+void compile_units(Interpreter *inter) {
+    f64 start = begin_metrics(inter);
+    compile_units2(inter);
+    CompileMetrics *m = &inter->metrics;
+    m->tokens = 0;
+    m->nodes = 0;
+    m->inlined_calls = 0;
+    for (u64 i = 0; i < inter->units.count; ++i) {
+        m->tokens += inter->units.dat[i].token_count;
+        m->nodes += inter->units.dat[i].node_count;
+        m->inlined_calls += inter->units.dat[i].inlined_calls;
+    }
+    end_metrics(inter, start);
+}
 
-            case BYTECODE_INVALID: assert(false && "unreachable"); break;
-            case BYTECODE_CALL: {
-                inter->return_address = inter->program_counter + 1;
-                inter->program_counter = curr->imm.u;
+void print_compile_metrics(CompileMetrics *m, FILE *f) {
+    fprintf(f, "compile %.3f ms, %llu units parsed, %llu compiles\n", m->total_seconds * 1000, m->units_parsed, m->compiles);
+    fprintf(f, "%-16s %10s %8s\n", "phase", "ms", "share");
+    for (u64 i = 0; i < CompilePhase_COUNT; ++i) {
+        f64 seconds = m->phase_seconds[i];
+        f64 share = m->total_seconds > 0 ? 100 * seconds / m->total_seconds : 0;
+        fprintf(f, "%-16.*s %10.3f %7.2f%%\n", (s32)str_CompilePhase[i].count, str_CompilePhase[i].dat, seconds * 1000, share);
+    }
+    fprintf(f, "tokens %llu, nodes %llu, scope items %llu, inlined calls %llu\n", m->tokens, m->nodes, m->scope_items, m->inlined_calls);
+    fprintf(f, "bytecode %llu instructions, %llu bytes, compact %llu bytes\n", m->bytecode_count, m->bytecode_bytes, m->compact_bytes);
+    fprintf(f, "func arena %llu bytes, node arena %llu bytes\n", m->func_arena_bytes, m->node_arena_bytes);
+}
 
-                StackData return_addr = {};
-                return_addr.u = inter->return_address;
-                dynarray_append(&inter->stack, return_addr);
+void print_compile_metrics_json(CompileMetrics *m, FILE *f) {
+    fprintf(f, "{\"total_seconds\": %.9f, \"units_parsed\": %llu, \"compiles\": %llu,\n", m->total_seconds, m->units_parsed, m->compiles);
+    fprintf(f, " \"phases\": {");
+    for (u64 i = 0; i < CompilePhase_COUNT; ++i) {
+        fprintf(f, "%s\"%.*s\": %.9f", i == 0 ? "" : ", ", (s32)str_CompilePhase[i].count, str_CompilePhase[i].dat, m->phase_seconds[i]);
+    }
+    fprintf(f, "},\n");
+    fprintf(f, " \"tokens\": %llu, \"nodes\": %llu, \"scope_items\": %llu, \"inlined_calls\": %llu, \"bytecode_count\": %llu, \"bytecode_bytes\": %llu, \"compact_bytes\": %llu,\n", m->tokens, m->nodes, m->scope_items, m->inlined_calls, m->bytecode_count, m->bytecode_bytes, m->compact_bytes);
+    fprintf(f, " \"func_arena_bytes\": %llu, \"node_arena_bytes\": %llu}\n", m->func_arena_bytes, m->node_arena_bytes);
+}
 
-                StackData base = {};
-                base.u = inter->base_stackframe_index;
-                inter->base_stackframe_index = inter->stack.count;
-                dynarray_append(&inter->stack, base);
-            } break;
-            case BYTECODE_RETURN: {
-                if (inter->base_stackframe_index == 0) {
-                    return true;
-                }
-                // save result then cleanup
-                StackData result = dynarray_pop(&inter->stack);
+// value of the last expression statement of a unit
+bool get_unit_value(Interpreter *inter, u64 unit_index, f64 *value_out) {
+    if (unit_index >= inter->units.count) return false;
+    Unit *u = inter->units.dat + unit_index;
+    if (u->stale) return false;
+    for (u64 j = u->statements.count; j-- > 0;) {
+        Node *inner = u->statements.dat[j]->nodes[0];
+        if (inner->type == NODE_FUNCTIONDEF || inner->type == NODE_VARIABLEDEF) continue;
+        if (!u->results.dat[j].has_value) return false;
+        *value_out = u->results.dat[j].value.f;
+        return true;
+    }
+    return false;
+}
 
-                inter->stack.count = inter->base_stackframe_index + 1;
-                inter->base_stackframe_index = dynarray_pop(&inter->stack).u;
-                inter->return_address = dynarray_pop(&inter->stack).u;
-                inter->program_counter = inter->return_address;
+// everything is compiled and evaluated again by the next compile_units, no statement result
+// or cached global is reused
+void invalidate_units(Interpreter *inter) {
+    for (u64 i = 0; i < inter->units.count; ++i) inter->units.dat[i].changed = true;
+    inter->global_cache.count = 0;
+}
 
-                for (u64 i = 0; i < curr->imm.u; ++i) {
-                    dynarray_pop(&inter->stack);
-                }
-                dynarray_append(&inter->stack, result);
-            } break;
-            case BYTECODE_PUSH_ARG: {
-                StackData sd = inter->stack.dat[inter->base_stackframe_index - 2 - curr->imm.u];
-                dynarray_append(&inter->stack, sd);
-                inter->program_counter += 1;
-            } break;
-            case BYTECODE_PUSH: {
-                dynarray_append(&inter->stack, curr->imm);
-                inter->program_counter += 1;
-            } break;
-            case BYTECODE_NEG: {
-                StackData sd = dynarray_pop(&inter->stack);
-                sd.f = -sd.f;
-                dynarray_append(&inter->stack, sd);
-                inter->program_counter += 1;
-            } break;
-            case BYTECODE_ADD: {
-                StackData sd1 = dynarray_pop(&inter->stack);
-                StackData sd2 = dynarray_pop(&inter->stack);
-                StackData sd3 = {};
+#define HEAT_SOURCE (~0ull)
 
-                sd3.f = sd1.f + sd2.f;
-                dynarray_append(&inter->stack, sd3);
-                inter->program_counter += 1;
-            } break;
-            case BYTECODE_SUB: {
-                StackData sd1 = dynarray_pop(&inter->stack);
-                StackData sd2 = dynarray_pop(&inter->stack);
-                StackData sd3 = {};
+// samples whose pc maps to text[start..end] of a unit, or of Interpreter::src when unit is HEAT_SOURCE
+struct HeatSpan {
+    u64 unit;
+    u64 start;
+    u64 end;
+    u64 hits;
+};
 
-                sd3.f = sd1.f - sd2.f;
-                dynarray_append(&inter->stack, sd3);
-                inter->program_counter += 1;
-            } break;
-            case BYTECODE_MUL: {
-                StackData sd1 = dynarray_pop(&inter->stack);
-                StackData sd2 = dynarray_pop(&inter->stack);
-                StackData sd3 = {};
+bool locate_text(String text, String source, u64 *start_out) {
+    if (!text.dat || !source.dat || text.dat < source.dat || text.dat + text.count > source.dat + source.count) return false;
+    *start_out = (u64)(text.dat - source.dat);
+    return true;
+}
 
-                sd3.f = sd1.f * sd2.f;
-                dynarray_append(&inter->stack, sd3);
-                inter->program_counter += 1;
+// samples of the program of the last compile added up for each token they ran code of, only
+// the innermost frame of a sample counts. Spans are ordered by unit and start, code that no
+// source text maps to, like folded constants, is left out
+void heat_spans(Interpreter *inter, Samples *samples, DynArray<HeatSpan> *out) {
+    Program *program = &inter->program;
+    out->count = 0;
+    for (u64 i = 0; i < samples->sample_ends.count; ++i) {
+        u64 pc = samples->frames.dat[i == 0 ? 0 : samples->sample_ends.dat[i - 1]];
+        if (pc >= program->source_map.count) continue;
+        String text = program->source_map.dat[pc]->text;
+
+        HeatSpan span = {};
+        span.unit = HEAT_SOURCE;
+        bool found = locate_text(text, inter->src, &span.start);
+        for (u64 u = 0; u < inter->units.count && !found; ++u) {
+            Unit *unit = inter->units.dat + u;
+            found = locate_text(text, String {unit->text.dat, unit->text.count}, &span.start);
+            span.unit = u;
+        }
+        if (!found) continue;
+        span.end = span.start + text.count;
+
+        u64 k = out->count;
+        while (k > 0 && (out->dat[k - 1].unit > span.unit || (out->dat[k - 1].unit == span.unit && out->dat[k - 1].start > span.start))) k -= 1;
+        if (k > 0 && out->dat[k - 1].unit == span.unit && out->dat[k - 1].start == span.start) {
+            out->dat[k - 1].hits += 1;
+            continue;
+        }
+        span.hits = 1;
+        dynarray_append(out, span);
+        memmove(out->dat + k + 1, out->dat + k, (out->count - 1 - k) * sizeof(HeatSpan));
+        out->dat[k] = span;
+    }
+}
 
-            } break;
-            case BYTECODE_DIV: {
-                StackData sd1 = dynarray_pop(&inter->stack);
-                StackData sd2 = dynarray_pop(&inter->stack);
-                StackData sd3 = {};
+// texts of every unit, unit i is text[ends[i - 1]..ends[i]]
+struct WorkerJob {
+    u64 id;
+    DynArray<u8> text;
+    DynArray<u64> ends;
+    bool sampling;
+};
 
-                sd3.f = sd1.f / sd2.f;
-                dynarray_append(&inter->stack, sd3);
-                inter->program_counter += 1;
+struct UnitValue {
+    bool has_value;
+    f64 value;
+};
 
-            } break;
-            case BytecodeType_COUNT: assert(false && "unreachable"); break;
-        }
-    }
+struct WorkerResults {
+    u64 job_id;
+    bool has_errors;
+    DynArray<UnitValue> values;
+    // of the whole evaluation when the job was sampled
+    DynArray<HeatSpan> heat;
+    CompileMetrics metrics;
+};
 
-    return false;
-}
+#define WORKER_RESULTS_NEW 4
+
+// compiles and evaluates snapshots of the units on its own thread so the ui never waits on it
+struct Worker {
+    Interpreter *inter;
+    Thread thread;
+    Semaphore job_ready;
+
+    // guards everything up to and including pending
+    Mutex lock;
+    bool quit;
+    bool has_job;
+    u64 next_job_id;
+    WorkerJob pending;
+    // copied into the jobs posted from now on
+    bool sampling;
+
+    // only touched by the worker thread
+    WorkerJob active;
+    Samples samples;
+
+    // set when a newer job is posted, the interpreter stops at the next unit, statement or slice
+    volatile u32 cancel;
+
+    // triple buffer, the worker fills back and swaps it with middle, the ui swaps middle
+    // with front when middle has WORKER_RESULTS_NEW set
+    WorkerResults results[3];
+    u32 back;
+    u32 front;
+    volatile u32 middle;
+};
 
-void reset_interpreter(Interpreter *inter) {
-    inter->src = {};
+void worker_main(void *data) {
+    Worker *w = (Worker *)data;
+    Interpreter *inter = w->inter;
+    inter->cancel = &w->cancel;
 
-    inter->lex.tokens.count = 0;
-    inter->lex.iter = 0;
+    while (true) {
+        semaphore_wait(&w->job_ready);
 
-    inter->ctx.node_stack.count = 0;
-    inter->ctx.op_stack.count = 0;
-    inter->ctx.iter = 0;
-    inter->ctx.root = nullptr;
+        mutex_lock(&w->lock);
+        if (w->quit) {
+            mutex_unlock(&w->lock);
+            return;
+        }
+        // only the newest snapshot is kept, so older ones are dropped before they start
+        bool has_job = w->has_job;
+        if (has_job) {
+            WorkerJob tmp = w->active;
+            w->active = w->pending;
+            w->pending = tmp;
+            w->has_job = false;
+            atomic_store(&w->cancel, 0);
+        }
+        mutex_unlock(&w->lock);
+        if (!has_job) continue;
 
+        WorkerJob *job = &w->active;
+        for (u64 i = 0; i < job->ends.count; ++i) {
+            u64 start = i == 0 ? 0 : job->ends.dat[i - 1];
+            set_unit_text(inter, i, String {job->text.dat + start, job->ends.dat[i] - start});
+        }
+        // a sampled job evaluates everything so the heat covers every unit and not only the edited ones
+        if (job->sampling) {
+            invalidate_units(inter);
+            samples_reset(&w->samples, 0);
+            inter->samples = &w->samples;
+        }
+        compile_units(inter);
+        inter->samples = nullptr;
+        if (is_cancelled(inter)) continue;
+
+        WorkerResults *results = w->results + w->back;
+        results->job_id = job->id;
+        results->has_errors = inter->errors.count > 0;
+        results->values.count = 0;
+        for (u64 i = 0; i < job->ends.count; ++i) {
+            UnitValue v = {};
+            v.has_value = !results->has_errors && get_unit_value(inter, i, &v.value);
+            dynarray_append(&results->values, v);
+        }
+        results->heat.count = 0;
+        if (job->sampling && !results->has_errors) heat_spans(inter, &w->samples, &results->heat);
+        results->metrics = inter->metrics;
+        w->back = atomic_exchange(&w->middle, w->back | WORKER_RESULTS_NEW) & ~WORKER_RESULTS_NEW;
+    }
+}
 
-    inter->bytecode.count = 0;
-    inter->symbol_ids.count = 0;
-    inter->symbols.count = 0;
-    arena_clear(&inter->func_arena);
-    arena_clear(&inter->ctx.node_arena);
+bool worker_start(Worker *w, Interpreter *inter) {
+    w->inter = inter;
+    w->back = 0;
+    w->middle = 1;
+    w->front = 2;
+    if (!semaphore_init(&w->job_ready, 0)) return false;
+    return thread_create(&w->thread, worker_main, w);
+}
 
-    inter->program_counter = 0;
-    inter->return_address = 0;
-    inter->base_stackframe_index = 0;
+void worker_stop(Worker *w) {
+    mutex_lock(&w->lock);
+    w->quit = true;
+    mutex_unlock(&w->lock);
+    atomic_store(&w->cancel, 1);
+    semaphore_signal(&w->job_ready);
+    thread_join(&w->thread);
+}
 
-    inter->stack.count = 0;
-    inter->errors.count = 0;
+// replaces any job the worker has not started yet and cancels the one it is running
+void worker_post(Worker *w, String *texts, u64 count) {
+    mutex_lock(&w->lock);
+    WorkerJob *job = &w->pending;
+    w->next_job_id += 1;
+    job->id = w->next_job_id;
+    job->text.count = 0;
+    job->ends.count = 0;
+    for (u64 i = 0; i < count; ++i) {
+        string_builder_concat(&job->text, texts[i]);
+        dynarray_append(&job->ends, job->text.count);
+    }
+    job->sampling = w->sampling;
+    w->has_job = true;
+    atomic_store(&w->cancel, 1);
+    mutex_unlock(&w->lock);
+    semaphore_signal(&w->job_ready);
 }
 
+// takes effect with the next worker_post
+void worker_set_sampling(Worker *w, bool sampling) {
+    mutex_lock(&w->lock);
+    w->sampling = sampling;
+    mutex_unlock(&w->lock);
+}
 
-void compile(Interpreter *inter, String src) {
-    tokenize(inter, src);
-    if (inter->errors.count == 0) parse(inter);
-    if (inter->errors.count == 0) graphviz_out(inter);
-    if (inter->errors.count == 0) typecheck_tree(inter);
-    if (inter->errors.count == 0) bytecode_from_tree(inter);
+// newest results the ui has not seen yet or nullptr, never blocks
+WorkerResults *worker_poll(Worker *w) {
+    if (!(atomic_load(&w->middle) & WORKER_RESULTS_NEW)) return nullptr;
+    w->front = atomic_exchange(&w->middle, w->front) & ~WORKER_RESULTS_NEW;
+    return w->results + w->front;
 }
 
 
@@ -1384,6 +6169,11 @@ struct UI_Pane {
     u64 *text_count;
     u64 text_capacity;
 
+    // drawn under the text, set by set_pane_heat every frame
+    HeatSpan *heat;
+    u64 heat_count;
+    u64 heat_max;
+
     Ui_Event event;
 
 };
@@ -1619,6 +6409,18 @@ Ui_Event create_pane(UI_State *ui, u64 flags, u64 hash, f32 x, f32 y, f32 w, f32
     return pane.event;
 }
 
+// heat of the pane created last
+void set_pane_heat(UI_State *ui, HeatSpan *spans, u64 count) {
+    DynArray<UI_Pane> *panes = ui->ui_panes + ui->active_panes_id;
+    UI_Pane *pane = panes->dat + panes->count - 1;
+    pane->heat = spans;
+    pane->heat_count = count;
+    pane->heat_max = 0;
+    for (u64 i = 0; i < count; ++i) {
+        if (spans[i].hits > pane->heat_max) pane->heat_max = spans[i].hits;
+    }
+}
+
 struct QuadData {
     u32 vao;
     u32 vbo_coords;
@@ -1726,6 +6528,23 @@ void draw_text(String text, f32 x, f32 y, f32 size, V4f32 color) {
     glDisable(GL_BLEND);
 }
 
+// the hottest span of the pane gets the strongest red
+void draw_heat(UI_Pane *pane) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    f32 bar_size = TEXT_INPUT_FONT_SIZE - 8;
+    for (u64 i = 0; i < pane->heat_count; ++i) {
+        HeatSpan *span = pane->heat + i;
+        // edited since it was sampled
+        if (span->end > *pane->text_count) continue;
+        f32 x = measure_text(String {pane->text_buf, span->start}, TEXT_INPUT_FONT_SIZE);
+        f32 w = measure_text(String {pane->text_buf + span->start, span->end - span->start}, TEXT_INPUT_FONT_SIZE);
+        f32 heat = (f32)span->hits / (f32)pane->heat_max;
+        draw_rectangle(pane->x + TEXT_INPUT_MARGIN + x, pane->y + bar_size / 2.0f, w, bar_size, make_V4f32(1.0f, 0.1f, 0, 0.15f + 0.6f * heat));
+    }
+    glDisable(GL_BLEND);
+}
+
 void draw_ui(UI_State *ui) {
 
     DynArray<UI_Pane> *panes = ui->ui_panes + ui->active_panes_id;
@@ -1796,6 +6615,7 @@ void draw_ui(UI_State *ui) {
         }
 
         if (has_flags(pane->flags, PANE_TEXT_DISPLAY)) {
+            if (pane->heat_count > 0) draw_heat(pane);
             String s = string_printf(scratch, "%.*s", (int)*pane->text_count, pane->text_buf);
             draw_text(s, pane->x + TEXT_INPUT_MARGIN, pane->y + TEXT_INPUT_FONT_SIZE, TEXT_INPUT_FONT_SIZE, make_V4f32(1.0f, 1.0f, 1.0f, 1.0f));
         }
@@ -2202,13 +7022,80 @@ void end_ui(UI_State *ui) {
 
 
 
+struct EvalRange {
+    Program *program;
+    FunctionHandle f;
+    ExecutionContext ctx;
+    f64 *xs;
+    f64 *ys;
+    f64 *results;
+    u64 count;
+};
+
+void eval_range(void *data) {
+    EvalRange *range = (EvalRange *)data;
+    for (u64 i = 0; i < range->count; ++i) {
+        f64 args[] = {range->xs[i], range->ys[i]};
+        if (!execute_program_handle(range->program, &range->ctx, VM_THREADED, range->f, args, ARRAY_SIZE(args))) continue;
+        range->results[i] = dynarray_pop(&range->ctx.stack).f;
+    }
+}
+
+struct Sweep {
+    Program *program;
+    FunctionHandle f;
+    VmMode vm_mode;
+    // indexed by PoolWorker::index
+    ExecutionContext *contexts;
+    f64 *results;
+    u64 count;
+};
+
+// f(x, 1 - x) with x going from 0 to 1 in count steps
+void sweep_chunk(PoolWorker *worker, void *data, u64 begin, u64 end) {
+    Sweep *sweep = (Sweep *)data;
+    ExecutionContext *ctx = sweep->contexts + worker->index;
+    for (u64 i = begin; i < end; ++i) {
+        f64 x = (f64)i / (f64)sweep->count;
+        f64 args[] = {x, 1 - x};
+        if (!execute_program_handle(sweep->program, ctx, sweep->vm_mode, sweep->f, args, ARRAY_SIZE(args))) continue;
+        sweep->results[i] = dynarray_pop(&ctx->stack).f;
+    }
+}
+
+// seconds the sweep takes on a pool with thread_count threads
+f64 time_sweep(Sweep *sweep, u32 thread_count) {
+    Pool pool = {};
+    if (!pool_init(&pool, thread_count)) return 0;
+    ExecutionContext *contexts = (ExecutionContext *)calloc(pool.worker_count, sizeof(ExecutionContext));
+    for (u32 i = 0; i < pool.worker_count; ++i) {
+        execution_context_init(contexts + i, 1 << 10);
+    }
+    sweep->contexts = contexts;
+
+    PoolWorker *worker = pool_enter(&pool);
+    f64 start = time_seconds();
+    pool_parallel_for(worker, sweep->count, 1 << 12, sweep_chunk, sweep);
+    f64 seconds = time_seconds() - start;
+    pool_leave(worker);
+
+    for (u32 i = 0; i < pool.worker_count; ++i) {
+        execution_context_free(contexts + i);
+    }
+    free(contexts);
+    sweep->contexts = nullptr;
+    pool_free(&pool);
+    return seconds;
+}
+
 void test() {
     static Interpreter test_inter = {};
     // String src = str_lit("f(x, y):=x*y;f(1,2);");
-    String src = str_lit("(5+5+5);");
+    String src = str_lit("f(x, y):=x*y+x;a:=f(2,3);(5+5+5)*a;");
 
-    arena_init(&test_inter.func_arena, 100000);
-    arena_init(&test_inter.ctx.node_arena, 100000);
+    arena_init(&test_inter.func_arena, 1 << 20);
+    arena_init(&test_inter.ctx.node_arena, 1 << 20);
+    reset_interpreter(&test_inter);
     compile(&test_inter, src);
     for (u64 i = 0; i < test_inter.errors.count; ++i) {
         Error *err = test_inter.errors.dat + i;
@@ -2223,12 +7110,478 @@ void test() {
 
         printf("\n");
     }
-    print_bytecode(&test_inter.bytecode);
-    bool r = execute(&test_inter, str_lit("_s2"), nullptr, 0);
-    printf("r = %s\n", r ? "true" : "false");
-    if (r) {
-        printf("Result = %g\n", test_inter.stack.dat[test_inter.stack.count - 1].f);
+    print_bytecode(&test_inter.program.bytecode);
+    print_ir(&test_inter.ir, &test_inter.program);
+    print_ir_passes(&test_inter.ir);
+    print_reg_bytecode(&test_inter.program.reg_bytecode);
+
+    for (u64 mode = 0; mode < VmMode_COUNT; ++mode) {
+        test_inter.vm_mode = (VmMode)mode;
+        bool r = execute(&test_inter, str_lit("_s2"), nullptr, 0);
+        printf("%.*s r = %s\n", (s32)str_VmMode[mode].count, str_VmMode[mode].dat, r ? "true" : "false");
+        if (r) {
+            printf("Result = %g\n", dynarray_pop(&test_inter.exec.stack).f);
+        }
+
+        f64 args[] = {3, 4};
+        r = execute(&test_inter, str_lit("f"), args, ARRAY_SIZE(args));
+        if (r) {
+            printf("f(3, 4) = %g\n", dynarray_pop(&test_inter.exec.stack).f);
+        }
+    }
+    test_inter.vm_mode = VM_STACK;
+
+    // the same calls by name and by handle, the handle skips hashing and comparing the name
+    {
+        FunctionHandle f = get_function_handle(&test_inter.program, str_lit("f"));
+        u64 calls = 1 << 20;
+        f64 args[] = {3, 4};
+        f64 start = time_seconds();
+        for (u64 i = 0; i < calls; ++i) {
+            execute(&test_inter, str_lit("f"), args, ARRAY_SIZE(args));
+            test_inter.exec.stack.count -= 1;
+        }
+        f64 by_name = time_seconds() - start;
+        start = time_seconds();
+        for (u64 i = 0; i < calls; ++i) {
+            execute_handle(&test_inter, f, args, ARRAY_SIZE(args));
+            test_inter.exec.stack.count -= 1;
+        }
+        f64 by_handle = time_seconds() - start;
+        printf("%llu calls of f: by name %.3fs, by handle %.3fs, %llu args\n", calls, by_name, by_handle, function_arg_count(&test_inter.program, f));
+    }
+
+    f64 xs[1000] = {};
+    f64 ys[1000] = {};
+    for (u64 i = 0; i < ARRAY_SIZE(xs); ++i) {
+        xs[i] = (f64)i * 0.5;
+        ys[i] = 2 - (f64)i;
+    }
+    f64 *columns[] = {xs, ys};
+    f64 results[ARRAY_SIZE(xs)] = {};
+    if (execute_batch(&test_inter, str_lit("f"), columns, ARRAY_SIZE(columns), results, ARRAY_SIZE(results))) {
+        u64 mismatches = 0;
+        for (u64 i = 0; i < ARRAY_SIZE(xs); ++i) {
+            f64 args[] = {xs[i], ys[i]};
+            execute(&test_inter, str_lit("f"), args, ARRAY_SIZE(args));
+            if (dynarray_pop(&test_inter.exec.stack).f != results[i]) mismatches += 1;
+        }
+        printf("batch simd level %d, %llu mismatches\n", simd_level, mismatches);
+        assert(mismatches == 0);
+    }
+
+    // the same program from 4 threads at once, each with its own context
+    f64 range_results[ARRAY_SIZE(xs)] = {};
+    EvalRange ranges[4] = {};
+    Thread threads[ARRAY_SIZE(ranges)] = {};
+    u64 per_range = ARRAY_SIZE(xs) / ARRAY_SIZE(ranges);
+    for (u64 i = 0; i < ARRAY_SIZE(ranges); ++i) {
+        EvalRange *range = ranges + i;
+        range->program = &test_inter.program;
+        range->f = get_function_handle(&test_inter.program, str_lit("f"));
+        execution_context_init(&range->ctx, 1 << 10);
+        range->xs = xs + i * per_range;
+        range->ys = ys + i * per_range;
+        range->results = range_results + i * per_range;
+        range->count = per_range;
+        thread_create(threads + i, eval_range, range);
+    }
+    u64 range_mismatches = 0;
+    for (u64 i = 0; i < ARRAY_SIZE(ranges); ++i) {
+        thread_join(threads + i);
+        execution_context_free(&ranges[i].ctx);
+    }
+    for (u64 i = 0; i < ARRAY_SIZE(xs); ++i) {
+        if (range_results[i] != results[i]) range_mismatches += 1;
+    }
+    printf("%llu threads, %llu mismatches\n", (u64)ARRAY_SIZE(ranges), range_mismatches);
+    assert(range_mismatches == 0);
+
+    // the same parameter sweep on one core and then on all of them
+    {
+        Sweep sweep = {};
+        sweep.program = &test_inter.program;
+        sweep.f = get_function_handle(&test_inter.program, str_lit("f"));
+        sweep.vm_mode = VM_THREADED;
+        sweep.count = 1 << 20;
+        sweep.results = (f64 *)calloc(sweep.count, sizeof(f64));
+        f64 *serial_results = (f64 *)calloc(sweep.count, sizeof(f64));
+
+        f64 serial = time_sweep(&sweep, 0);
+        memcpy(serial_results, sweep.results, sweep.count * sizeof(f64));
+        memset(sweep.results, 0, sweep.count * sizeof(f64));
+        u32 cores = processor_count();
+        f64 parallel = time_sweep(&sweep, cores - 1);
+
+        u64 sweep_mismatches = 0;
+        for (u64 i = 0; i < sweep.count; ++i) {
+            if (sweep.results[i] != serial_results[i]) sweep_mismatches += 1;
+        }
+        printf("sweep of %llu: 1 core %.3fs, %u cores %.3fs, speedup %.2fx, %llu mismatches\n",
+            sweep.count, serial, cores, parallel, serial / parallel, sweep_mismatches);
+        assert(sweep_mismatches == 0);
+        free(serial_results);
+        free(sweep.results);
+    }
+
+    // sub, div and neg on every simd level against the scalar vm, 1023 lanes leave a tail on every vector width
+    {
+        reset_interpreter(&test_inter);
+        compile(&test_inter, str_lit("d(x, y):=x/-(x-y)-x/4-2+1/(x+1)-y/x-y/-(y-3);"));
+        assert(test_inter.errors.count == 0);
+        print_bytecode(&test_inter.program.bytecode);
+        static f64 dxs[1023] = {};
+        static f64 dys[1023] = {};
+        static f64 dresults[ARRAY_SIZE(dxs)] = {};
+        for (u64 i = 0; i < ARRAY_SIZE(dxs); ++i) {
+            dxs[i] = (f64)i * 0.5 + 0.25;
+            dys[i] = 2 - (f64)i;
+        }
+        f64 *dcolumns[] = {dxs, dys};
+        SimdLevel detected = simd_detect();
+        for (u32 level = SIMD_SSE2; level <= (u32)detected; ++level) {
+            simd_select((SimdLevel)level);
+            bool ok = execute_batch(&test_inter, str_lit("d"), dcolumns, ARRAY_SIZE(dcolumns), dresults, ARRAY_SIZE(dresults));
+            assert(ok);
+            u64 mismatches = 0;
+            for (u64 i = 0; i < ARRAY_SIZE(dxs); ++i) {
+                f64 args[] = {dxs[i], dys[i]};
+                execute(&test_inter, str_lit("d"), args, ARRAY_SIZE(args));
+                if (dynarray_pop(&test_inter.exec.stack).f != dresults[i]) mismatches += 1;
+            }
+            printf("d batch simd level %u, %llu lanes, %llu mismatches\n", level, (u64)ARRAY_SIZE(dxs), mismatches);
+            assert(mismatches == 0);
+        }
+        simd_init();
+    }
+
+    // x+1 is computed once per call and read back as a local by the stack vms
+    {
+        reset_interpreter(&test_inter);
+        compile(&test_inter, str_lit("c(x):=(x+1)*(x+1)+(x+1);"));
+        assert(test_inter.errors.count == 0);
+        print_bytecode(&test_inter.program.bytecode);
+        FunctionHandle c = get_function_handle(&test_inter.program, str_lit("c"));
+        for (u64 mode = 0; mode < VmMode_COUNT; ++mode) {
+            test_inter.vm_mode = (VmMode)mode;
+            f64 x = 2;
+            bool ok = execute_handle(&test_inter, c, &x, 1);
+            assert(ok);
+            f64 result = dynarray_pop(&test_inter.exec.stack).f;
+            printf("%.*s c(2) = %g\n", (s32)str_VmMode[mode].count, str_VmMode[mode].dat, result);
+            assert(result == 12);
+        }
+        test_inter.vm_mode = VM_STACK;
+
+        // the local and the three values of the muladd
+        printf("c stack depth %llu, program %llu\n", test_inter.program.stack_depths.dat[c], test_inter.program.max_stack_depth);
+        assert(test_inter.program.stack_depths.dat[c] == 4);
+        assert(test_inter.program.max_stack_depth == 4);
+        // a negation of nothing in place of the first push is rejected before anything runs
+        test_inter.program.bytecode.dat[test_inter.program.symbol_ids.dat[c]].type = BYTECODE_NEG;
+        bool verified = verify_bytecode(&test_inter);
+        Error *err = test_inter.errors.dat + test_inter.errors.count - 1;
+        printf("tampered c verified %s, %.*s in statement %llu\n", verified ? "true" : "false", (s32)err->err_string.count, err->err_string.dat, err->statement_id);
+        assert(!verified);
+    }
+
+    // the sweep once more on one core in native code, checked against the register vm
+    {
+        String jit_src = str_lit("g(x, y):=x*x-y;h(x, y):=(x+y)*(x-y)/(x*y+2);f(x, y):=x*3+h(x, g(y, x));");
+        reset_interpreter(&test_inter);
+        compile(&test_inter, jit_src);
+        assert(test_inter.errors.count == 0);
+        printf("%llu calls inlined\n", test_inter.inlined_calls);
+        assert(test_inter.inlined_calls == 1);
+        Sweep sweep = {};
+        sweep.program = &test_inter.program;
+        sweep.f = get_function_handle(&test_inter.program, str_lit("f"));
+        sweep.count = 1 << 20;
+        sweep.results = (f64 *)calloc(sweep.count, sizeof(f64));
+        f64 *jit_results = (f64 *)calloc(sweep.count, sizeof(f64));
+
+        sweep.vm_mode = VM_THREADED;
+        f64 threaded = time_sweep(&sweep, 0);
+        sweep.vm_mode = VM_JIT;
+        f64 jit = time_sweep(&sweep, 0);
+        memcpy(jit_results, sweep.results, sweep.count * sizeof(f64));
+
+        ExecutionContext ctx = {};
+        execution_context_init(&ctx, 1 << 10);
+        ctx.jit_differential = true;
+        u64 differences = 0;
+        for (u64 i = 0; i < sweep.count; i += 97) {
+            f64 x = (f64)i / (f64)sweep.count;
+            f64 args[] = {x, 1 - x};
+            bool ok = execute_program_handle(&test_inter.program, &ctx, VM_JIT, sweep.f, args, ARRAY_SIZE(args));
+            if (!ok || memcmp(&jit_results[i], &ctx.stack.dat[ctx.stack.count - 1], sizeof(f64)) != 0) differences += 1;
+            if (ok) ctx.stack.count -= 1;
+        }
+        execution_context_free(&ctx);
+        printf("jit sweep of %llu: threaded %.3fs, jit %.3fs (%s), speedup %.2fx, %llu differences\n",
+            sweep.count, threaded, jit, test_inter.program.has_jit ? "native" : "fallback", threaded / jit, differences);
+        assert(differences == 0);
+        free(jit_results);
+        free(sweep.results);
+    }
+
+    // a pushed number goes into the op that pops it and a pushed argument into the op after it,
+    // both functions ran 6 instructions a call before the peephole pass
+    {
+        reset_interpreter(&test_inter);
+        compile(&test_inter, str_lit("f(x):=x/2+1;g(x, y):=x*y+1;"));
+        assert(test_inter.errors.count == 0);
+        Program *p = &test_inter.program;
+        FunctionHandle f = get_function_handle(p, str_lit("f"));
+        FunctionHandle g = get_function_handle(p, str_lit("g"));
+        Bytecode *fc = p->bytecode.dat + p->symbol_ids.dat[f];
+        assert(fc[0].type == BYTECODE_PUSH_ARG && fc[0].imm.u == 0);
+        assert(fc[1].type == BYTECODE_DIV_CONST && fc[1].imm.f == 2);
+        assert(fc[2].type == BYTECODE_ADD_CONST && fc[2].imm.f == 1);
+        assert(fc[3].type == BYTECODE_RETURN1);
+        Bytecode *gc = p->bytecode.dat + p->symbol_ids.dat[g];
+        assert(gc[0].type == BYTECODE_PUSH_ARG && gc[0].imm.u == 1);
+        assert(gc[1].type == BYTECODE_MUL_ARG && gc[1].imm.u == 0);
+        assert(gc[2].type == BYTECODE_ADD_CONST && gc[2].imm.f == 1);
+        assert(gc[3].type == BYTECODE_RETURN2);
+
+        for (u64 mode = 0; mode < VmMode_COUNT; ++mode) {
+            test_inter.vm_mode = (VmMode)mode;
+            f64 args[] = {3, 4};
+            bool ok = execute_handle(&test_inter, f, args, 1);
+            assert(ok && dynarray_pop(&test_inter.exec.stack).f == 2.5);
+            ok = execute_handle(&test_inter, g, args, 2);
+            assert(ok && dynarray_pop(&test_inter.exec.stack).f == 13);
+        }
+        test_inter.vm_mode = VM_STACK;
+        f64 x = 3;
+        execute_handle(&test_inter, f, &x, 1);
+        dynarray_pop(&test_inter.exec.stack);
+        printf("f(x):=x/2+1 %llu instructions a call\n", test_inter.exec.instructions);
+        assert(test_inter.exec.instructions == 4);
+    }
+
+    // the same calls on the 16 byte bytecode and on the compact encoding
+    {
+        String compact_src = str_lit("g(x, y):=x*x-y+1;h(x, y):=(x+y)*(x-y)/(x*y+2)+g(x, 3);f(x, y):=x*3+h(x, g(y, x))-g(y, 2);");
+        reset_interpreter(&test_inter);
+        compile(&test_inter, compact_src);
+        assert(test_inter.errors.count == 0);
+        Program *p = &test_inter.program;
+        u64 wide_bytes = p->bytecode.count * sizeof(Bytecode);
+        u64 compact_bytes = p->compact_code.count + p->constants.count * sizeof(StackData);
+        FunctionHandle f = get_function_handle(p, str_lit("f"));
+
+        u64 count = 1 << 18;
+        VmMode modes[] = {VM_STACK, VM_COMPACT};
+        f64 seconds[2] = {};
+        f64 sums[2] = {};
+        u64 instructions = 0;
+        ExecutionContext ctx = {};
+        execution_context_init(&ctx, 1024);
+        for (u64 m = 0; m < ARRAY_SIZE(modes); ++m) {
+            f64 start = time_seconds();
+            for (u64 i = 0; i < count; ++i) {
+                f64 args[] = {(f64)(i & 1023), (f64)(i >> 10)};
+                if (!execute_program_handle(p, &ctx, modes[m], f, args, ARRAY_SIZE(args))) continue;
+                sums[m] += dynarray_pop(&ctx.stack).f;
+                if (m == 0) instructions += ctx.instructions;
+            }
+            seconds[m] = time_seconds() - start;
+        }
+        execution_context_free(&ctx);
+        printf("compact bytecode: %llu bytes (%llu code, %llu constants) vs %llu bytes, %llu calls stack %.3fs compact %.3fs, %s\n",
+            compact_bytes, p->compact_code.count, p->constants.count, wide_bytes, count, seconds[0], seconds[1],
+            memcmp(&sums[0], &sums[1], sizeof(f64)) == 0 ? "same" : "different");
+        assert(memcmp(&sums[0], &sums[1], sizeof(f64)) == 0);
+        printf("%.1f instructions per call\n", (f64)instructions / (f64)count);
+    }
+
+    // runaway recursion stops at max_call_depth
+    {
+        reset_interpreter(&test_inter);
+        compile(&test_inter, str_lit("r(x):=1+r(x);"));
+        FunctionHandle r = get_function_handle(&test_inter.program, str_lit("r"));
+        test_inter.exec.max_call_depth = 1000;
+        for (u64 mode = 0; mode < VmMode_COUNT; ++mode) {
+            test_inter.vm_mode = (VmMode)mode;
+            test_inter.errors.count = 0;
+            f64 x = 1;
+            bool ok = execute_handle(&test_inter, r, &x, 1);
+            String err = test_inter.errors.count > 0 ? test_inter.errors.dat[0].err_string : str_lit("none");
+            printf("%.*s depth 1000: %s, error %.*s\n", (s32)str_VmMode[mode].count, str_VmMode[mode].dat, ok ? "ok" : "failed", (s32)err.count, err.dat);
+            assert(!ok && test_inter.errors.count > 0);
+        }
+        test_inter.errors.count = 0;
+        test_inter.exec.max_call_depth = 0;
+        test_inter.vm_mode = VM_STACK;
+    }
+
+#if HAS_PROFILER
+    // where the time of a chain of calls goes, as a table and as json
+    {
+        reset_interpreter(&test_inter);
+        compile(&test_inter, str_lit("f0(x):=x/2+1;f1(x):=f0(f0(x));f2(x):=f1(f1(x));f3(x):=f2(f2(x));f4(x):=f3(f3(x));f5(x):=f4(f4(x));"));
+        assert(test_inter.errors.count == 0);
+        FunctionHandle f5 = get_function_handle(&test_inter.program, str_lit("f5"));
+        Profile profile = {};
+        test_inter.profile = &profile;
+        test_inter.vm_mode = VM_REGISTER;
+        for (u64 i = 0; i < 1000; ++i) {
+            f64 x = (f64)i;
+            if (execute_handle(&test_inter, f5, &x, 1)) dynarray_pop(&test_inter.exec.stack);
+        }
+        test_inter.profile = nullptr;
+        test_inter.vm_mode = VM_STACK;
+        print_profile(&test_inter.program, &profile, stdout);
+        print_profile_json(&test_inter.program, &profile, stdout);
+        profile_free(&profile);
+    }
+#endif
+
+    // the same chain sampled, per call chain for flame graphs and per token of the source
+    {
+        reset_interpreter(&test_inter);
+        String sampled_src = str_lit("f0(x):=x/2+1;f1(x):=f0(f0(x));f2(x):=f1(f1(x));f3(x):=f2(f2(x));f4(x):=f3(f3(x));f5(x):=f4(f4(x));");
+        compile(&test_inter, sampled_src);
+        assert(test_inter.errors.count == 0);
+        FunctionHandle f5 = get_function_handle(&test_inter.program, str_lit("f5"));
+        Samples samples = {};
+        samples_reset(&samples, 97);
+        test_inter.samples = &samples;
+        for (u64 i = 0; i < 1000; ++i) {
+            f64 x = (f64)i;
+            if (execute_handle(&test_inter, f5, &x, 1)) dynarray_pop(&test_inter.exec.stack);
+        }
+        test_inter.samples = nullptr;
+        printf("%llu samples\n", samples.sample_ends.count);
+        print_collapsed_stacks(&test_inter.program, &samples, stdout);
+        DynArray<HeatSpan> heat = {};
+        heat_spans(&test_inter, &samples, &heat);
+        for (u64 i = 0; i < heat.count; ++i) {
+            HeatSpan *span = heat.dat + i;
+            u64 line_start = span->start > 8 ? span->start - 8 : 0;
+            printf("%4llu hits at %llu '%.*s' in ...%.*s\n", span->hits, span->start, (s32)(span->end - span->start), sampled_src.dat + span->start,
+                (s32)(span->end - line_start + 4), sampled_src.dat + line_start);
+        }
+        heat.count = 0;
+        dynarray_set_cap(&heat, 0);
+        samples_free(&samples);
+    }
+
+    // where the time of a compile goes
+    {
+        reset_interpreter(&test_inter);
+        compile(&test_inter, str_lit("f0(x):=x/2+1;f1(x):=f0(f0(x));f2(x):=f1(f1(x));a:=f2(3);f2(a)-a;"));
+        assert(test_inter.errors.count == 0);
+        CompileMetrics *m = &test_inter.metrics;
+        f64 phases = 0;
+        for (u64 i = 0; i < CompilePhase_COUNT; ++i) phases += m->phase_seconds[i];
+        assert(phases <= m->total_seconds);
+        print_compile_metrics(m, stdout);
+        print_compile_metrics_json(m, stdout);
+    }
+
+    // a unit that failed on a name another unit defines later is typechecked again
+    {
+        static Interpreter unit_inter = {};
+        arena_init(&unit_inter.func_arena, 1 << 20);
+        arena_init(&unit_inter.ctx.node_arena, 1 << 20);
+        set_unit_text(&unit_inter, 0, str_lit("f(x) := g(x) + 1"));
+        set_unit_text(&unit_inter, 1, str_lit("f(3)"));
+        set_unit_text(&unit_inter, 2, str_lit(""));
+        compile_units(&unit_inter);
+        assert(unit_inter.errors.count == 1);
+        // recompiles don't grow the node arena, the trees, their scopes and inlined copies live in the units
+        u64 node_arena_pos = arena_get_pos(&unit_inter.ctx.node_arena);
+        set_unit_text(&unit_inter, 1, str_lit("f(4)"));
+        compile_units(&unit_inter);
+        assert(unit_inter.errors.count == 1);
+        set_unit_text(&unit_inter, 2, str_lit("g(x) := x * 2"));
+        compile_units(&unit_inter);
+        assert(unit_inter.errors.count == 0);
+        f64 value = 0;
+        assert(get_unit_value(&unit_inter, 1, &value) && value == 9);
+        compile_units(&unit_inter);
+        assert(unit_inter.errors.count == 0);
+        assert(arena_get_pos(&unit_inter.ctx.node_arena) == node_arena_pos);
+        // g into f and f into the call, the unit of f was not compiled again by the last edits
+        assert(unit_inter.metrics.inlined_calls == 2);
+    }
+
+    // a cached value of another definition with the same hash is not used
+    {
+        reset_interpreter(&test_inter);
+        test_inter.global_cache.count = 0;
+        compile(&test_inter, str_lit("a:=3;"));
+        assert(test_inter.global_cache.count == 1);
+        u64 hash = test_inter.global_cache.dat[0].hash;
+        reset_interpreter(&test_inter);
+        compile(&test_inter, str_lit("a:=2;"));
+        test_inter.global_cache.dat[0].hash = hash;
+        reset_interpreter(&test_inter);
+        compile(&test_inter, str_lit("a:=3;"));
+        assert(test_inter.errors.count == 0);
+        assert(test_inter.program.globals.dat[0].f == 3);
+    }
+
+    // independent heavy globals, on a pool they take about as long as the slowest one
+    {
+        String heavy = str_lit(
+            "f0(x):=x/2+1;f1(x):=f0(f0(x));f2(x):=f1(f1(x));f3(x):=f2(f2(x));f4(x):=f3(f3(x));"
+            "f5(x):=f4(f4(x));f6(x):=f5(f5(x));f7(x):=f6(f6(x));f8(x):=f7(f7(x));f9(x):=f8(f8(x));"
+            "f10(x):=f9(f9(x));f11(x):=f10(f10(x));f12(x):=f11(f11(x));f13(x):=f12(f12(x));"
+            "f14(x):=f13(f13(x));f15(x):=f14(f14(x));f16(x):=f15(f15(x));"
+            "g(x):=f16(f16(f16(f16(x))));a:=g(1);b:=g(2);c:=g(3);d:=g(4);e:=g(5);h:=g(6);k:=g(7);m:=g(8);"
+            "n:=a+b+c+d+e+h+k+m;");
+        Pool pool = {};
+        pool_init(&pool, processor_count() - 1);
+        f64 seconds[2] = {};
+        f64 values[2] = {};
+        for (u64 i = 0; i < 2; ++i) {
+            test_inter.pool = i == 0 ? nullptr : &pool;
+            test_inter.global_cache.count = 0;
+            reset_interpreter(&test_inter);
+            f64 start = time_seconds();
+            compile(&test_inter, heavy);
+            seconds[i] = time_seconds() - start;
+            if (test_inter.errors.count == 0) values[i] = dynarray_pop(&test_inter.program.globals).f;
+        }
+        u32 cores = pool.worker_count;
+        test_inter.pool = nullptr;
+        pool_free(&pool);
+        for (u64 i = 0; i < test_inter.pool_exec.count; ++i) {
+            execution_context_free(test_inter.pool_exec.dat + i);
+        }
+        test_inter.pool_exec.count = 0;
+        printf("8 globals: serial %.3fs %g, %u cores %.3fs %g\n", seconds[0], values[0], cores, seconds[1], values[1]);
+        assert(values[0] == values[1]);
+    }
+
+    // runs out of stack, resumed in slices of 1000 instructions until the error
+    reset_interpreter(&test_inter);
+    compile(&test_inter, str_lit("g(x):=g(x)+1;g(1);"));
+    if (execute_begin(&test_inter.program, &test_inter.exec, VM_STACK, str_lit("_s1"), nullptr, 0)) {
+        ExecuteBudget budget = {};
+        budget.instructions = 1000;
+        u64 slices = 0;
+        ExecuteStatus status = EXECUTE_SUSPENDED;
+        while (status == EXECUTE_SUSPENDED) {
+            status = execute_resume(&test_inter.program, &test_inter.exec, budget);
+            slices += 1;
+        }
+        String s = str_ExecuteStatus[status];
+        printf("%.*s after %llu slices\n", (s32)s.count, s.dat, slices);
+        assert(status == EXECUTE_ERROR);
+        if (status == EXECUTE_ERROR) {
+            String err = test_inter.exec.error.err_string;
+            printf("ERROR: %.*s\n", (s32)err.count, err.dat);
+        }
     }
+
+    // counted over every program compiled by test_inter above
+    printf("most common pairs after the peephole pass:\n");
+    print_bytecode_pairs(&test_inter, 20);
 }
 
 
@@ -2360,18 +7713,96 @@ void main() {
 
 UI_State ui = {};
 Interpreter inter = {};
+// owns inter once started
+Worker g_worker = {};
+Pool g_pool = {};
+
+#define STATS_LINES (4 + (CompilePhase_COUNT + 1) / 2)
+#define STATS_LINE_CAP 96
+
+// lines of the stats pane, the phases two to a line without their PHASE_ prefix
+void format_stats_lines(CompileMetrics *m, u8 lines[STATS_LINES][STATS_LINE_CAP], u64 counts[STATS_LINES]) {
+    u64 prefix = str_lit("PHASE_").count;
+    snprintf((char *)lines[0], STATS_LINE_CAP, "compile %.3f ms, %llu units parsed", m->total_seconds * 1000, m->units_parsed);
+    for (u64 i = 0; i < CompilePhase_COUNT; i += 2) {
+        char *line = (char *)lines[1 + i / 2];
+        String a = str_CompilePhase[i];
+        s32 n = snprintf(line, STATS_LINE_CAP, "%.*s %.3f ms", (s32)(a.count - prefix), a.dat + prefix, m->phase_seconds[i] * 1000);
+        if (i + 1 < CompilePhase_COUNT && n > 0) {
+            String b = str_CompilePhase[i + 1];
+            snprintf(line + n, STATS_LINE_CAP - (u64)n, "   %.*s %.3f ms", (s32)(b.count - prefix), b.dat + prefix, m->phase_seconds[i + 1] * 1000);
+        }
+    }
+    snprintf((char *)lines[STATS_LINES - 3], STATS_LINE_CAP, "tokens %llu  nodes %llu  scope items %llu  inlined %llu", m->tokens, m->nodes, m->scope_items, m->inlined_calls);
+    snprintf((char *)lines[STATS_LINES - 2], STATS_LINE_CAP, "bytecode %llu ops %llu B  compact %llu B", m->bytecode_count, m->bytecode_bytes, m->compact_bytes);
+    snprintf((char *)lines[STATS_LINES - 1], STATS_LINE_CAP, "func arena %llu KB  node arena %llu KB", m->func_arena_bytes / 1024, m->node_arena_bytes / 1024);
+    for (u64 i = 0; i < STATS_LINES; ++i) counts[i] = strlen((char *)lines[i]);
+}
+
+// compiles every line of the file as a unit without a window and prints the metrics of that
+// and of compiling again after an edit of the last line
+int run_metrics(const char *path, bool json) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        LOG_ERROR("Failed to open %s\n", path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    u64 size = (u64)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    u8 *text = (u8 *)malloc(size + 1);
+    size = fread(text, 1, size, f);
+    fclose(f);
+
+    u64 unit_count = 0;
+    u64 line_start = 0;
+    for (u64 i = 0; i <= size; ++i) {
+        if (i < size && text[i] != '\n') continue;
+        if (i == size && line_start == size) break;
+        // set_unit_text adds the terminator
+        u64 end = i;
+        while (end > line_start && (text[end - 1] == '\r' || text[end - 1] == ' ' || text[end - 1] == ';')) end -= 1;
+        set_unit_text(&inter, unit_count++, String {text + line_start, end - line_start});
+        line_start = i + 1;
+    }
+
+    compile_units(&inter);
+    CompileMetrics cold = inter.metrics;
+    u64 error_count = inter.errors.count;
+    if (unit_count > 0) inter.units.dat[unit_count - 1].changed = true;
+    compile_units(&inter);
+    CompileMetrics edit = inter.metrics;
+
+    if (json) {
+        printf("{\"units\": %llu, \"errors\": %llu,\n\"cold\": ", unit_count, error_count);
+        print_compile_metrics_json(&cold, stdout);
+        printf(",\n\"edit\": ");
+        print_compile_metrics_json(&edit, stdout);
+        printf("}\n");
+    } else {
+        printf("%llu units, %llu errors\n\ncold\n", unit_count, error_count);
+        print_compile_metrics(&cold, stdout);
+        printf("\nedit of the last line\n");
+        print_compile_metrics(&edit, stdout);
+    }
+    free(text);
+    return 0;
+}
 
-int main(void) {
+int main(int argc, char **argv) {
 
     Arena t; arena_init(&t, 10000000);
     scratch = &t;
 
-    DynArray<u8> sb; dynarray_init(&sb, 65000);
 
 
+    // only the pages a compile touches end up resident, so these can be generous
+    arena_init(&inter.func_arena, 1ull << 28);
+    arena_init(&inter.ctx.node_arena, 1ull << 28);
 
-    arena_init(&inter.func_arena, 100000);
-    arena_init(&inter.ctx.node_arena, 100000);
+    // para --metrics <file> or --metrics-json <file> runs headless
+    if (argc == 3 && strcmp(argv[1], "--metrics") == 0) return run_metrics(argv[2], false);
+    if (argc == 3 && strcmp(argv[1], "--metrics-json") == 0) return run_metrics(argv[2], true);
 
 
     if (!create_window((s32)screen_w, (s32)screen_h, str_lit("Para"), &g_window)) return 1;
@@ -2469,6 +7900,25 @@ int main(void) {
 
     init_font_texture(str_lit("c:/windows/fonts/times.ttf"), TEXT_INPUT_FONT_SIZE);
 
+    if (!pool_init(&g_pool, processor_count() - 1)) {
+        LOG_ERROR("Failed to start thread pool\n");
+        return 1;
+    }
+    inter.pool = &g_pool;
+
+    if (!worker_start(&g_worker, &inter)) {
+        LOG_ERROR("Failed to start worker thread\n");
+        return 1;
+    }
+
+    bool show_heat = false;
+    // front buffer of the worker, valid until the next worker_poll
+    WorkerResults *shown_results = nullptr;
+
+    bool show_stats = false;
+    u8 stats_text_buf[STATS_LINES][STATS_LINE_CAP] = {};
+    u64 stats_text_count[STATS_LINES] = {};
+
     bool running = true;
     while (running) {
 
@@ -2485,6 +7935,32 @@ int main(void) {
         screen_h = input.screen_height;
         u64 tmp_pos = arena_get_pos(scratch);
 
+        // ctrl+p samples the evaluation and shows where it spends its time under the text
+        bool post = false;
+        if (input.buttons[BUTTON_CTRL].ended_down && button_pressed(input.buttons + BUTTON_P)) {
+            show_heat = !show_heat;
+            worker_set_sampling(&g_worker, show_heat);
+            post = true;
+        }
+        // ctrl+m shows the timings and sizes of the last compile
+        if (input.buttons[BUTTON_CTRL].ended_down && button_pressed(input.buttons + BUTTON_M)) {
+            show_stats = !show_stats;
+        }
+
+        WorkerResults *results = worker_poll(&g_worker);
+        if (results) {
+            shown_results = results;
+            for (u64 j = 0; j < ARRAY_SIZE(display_text_buf); ++j) {
+                display_text_count[j] = 0;
+                if (j < results->values.count && results->values.dat[j].has_value) {
+                    String s = string_printf(scratch, "%lg", results->values.dat[j].value);
+                    memcpy(display_text_buf[j], s.dat, s.count + 1);
+                    display_text_count[j] = s.count;
+                }
+            }
+            format_stats_lines(&results->metrics, stats_text_buf, stats_text_count);
+        }
+
         begin_ui(&ui);
         {
             create_pane(&ui, PANE_DRAGGABLE|PANE_RESIZEABLE|PANE_BACKGROUND_COLOR, 69420'0, 0, 0, 400, 500, light_gray, nullptr, nullptr, 0);
@@ -2493,68 +7969,38 @@ int main(void) {
             push_parent(&ui);
             for (u64 i = 0; i < 5; ++i) {
                 Ui_Event event = create_pane(&ui, PANE_TEXT_INPUT|PANE_TEXT_DISPLAY|PANE_BACKGROUND_COLOR, 79420+i, 0, 0, 400, 35, dark_green, text_buf[i], text_count + i, sizeof(text_buf[i]));
-                create_pane(&ui, PANE_TEXT_DISPLAY|PANE_BACKGROUND_COLOR, 80420+i, 0, 0, 400, 35, red, display_text_buf[i], display_text_count + i, sizeof(display_text_buf[i]));
-                if (event.text_input_changed) {
-                    if (event.text_input_changed) {
-
-                        sb.count = 0;
-
-                        for (u64 j = 0; j < ARRAY_SIZE(text_count); ++j) {
-                            if (text_count[j] > 0) {
-                                string_builder_concat(&sb, String {text_buf[j], text_count[j]});
-                                string_builder_append(&sb, ';');
-                            }
-                        }
-                        String src_ = string_builder_to_string(&sb);
-
-                        for (u64 j = 0; j < ARRAY_SIZE(display_text_buf); ++j) {
-                            display_text_count[j] = 0;
-                        }
-
-                        reset_interpreter(&inter);
-                        compile(&inter, src_);
-
-
-                        u64 node_id = 0;
-                        for (u64 j = 0; j < ARRAY_SIZE(text_count); ++j) {
-                            if (text_count[j] == 0) continue;
-
-                            bool skip = false;
-                            if (inter.errors.count > 0) skip = true;
-                            // while (inter->errors.count > 0) {
-                            //     Error *e = inter->errors.dat + inter->errors.count - 1;
-                            //     todo();
-                            // }
-                            if (!skip) {
-                                Node *prog = inter.ctx.root;
-                                Node *stmt = prog->nodes[node_id];
-
-                                bool is_definition = false;
-                                assert(stmt->node_count == 1);
-                                if (stmt->nodes[0]->type == NODE_FUNCTIONDEF || stmt->nodes[0]->type == NODE_VARIABLEDEF) {
-                                    is_definition = true;
-                                }
-
-
-                                if (is_definition) {
-                                    // todo();
-                                } else {
-                                    String stmt_s = string_printf(&t, "_s%llu", node_id);
-                                    execute(&inter, stmt_s, nullptr, 0);
-                                    String s = string_printf(scratch, "%lg", dynarray_pop(&inter.stack));
-                                    memcpy(display_text_buf[j], s.dat, s.count + 1);
-                                    display_text_count[j] = s.count;
-                                }
-                                node_id += 1;
-                            }
-                        }
+                // spans are ordered by unit
+                HeatSpan *spans = nullptr;
+                u64 span_count = 0;
+                if (show_heat && shown_results) {
+                    for (u64 j = 0; j < shown_results->heat.count; ++j) {
+                        if (shown_results->heat.dat[j].unit != i) continue;
+                        if (!spans) spans = shown_results->heat.dat + j;
+                        span_count += 1;
                     }
                 }
+                set_pane_heat(&ui, spans, span_count);
+                create_pane(&ui, PANE_TEXT_DISPLAY|PANE_BACKGROUND_COLOR, 80420+i, 0, 0, 400, 35, red, display_text_buf[i], display_text_count + i, sizeof(display_text_buf[i]));
+                if (event.text_input_changed) post = true;
+            }
+            if (post) {
+                String texts[ARRAY_SIZE(text_count)] = {};
+                for (u64 j = 0; j < ARRAY_SIZE(text_count); ++j) {
+                    texts[j] = String {text_buf[j], text_count[j]};
+                }
+                worker_post(&g_worker, texts, ARRAY_SIZE(texts));
             }
             pop_parent(&ui);
         }
         {
             create_pane(&ui, PANE_DRAGGABLE|PANE_BACKGROUND_COLOR, 1337420, 1366-800, 0, 800, 400, black, nullptr, nullptr, 0);
+            if (show_stats) {
+                push_parent(&ui);
+                for (u64 i = 0; i < STATS_LINES; ++i) {
+                    create_pane(&ui, PANE_TEXT_DISPLAY, 90420+i, 0, 0, 800, 35, black, stats_text_buf[i], stats_text_count + i, sizeof(stats_text_buf[i]));
+                }
+                pop_parent(&ui);
+            }
         }
 
         end_ui(&ui);
@@ -2571,6 +8017,8 @@ int main(void) {
         swap_buffers(&g_window);
         arena_set_pos(scratch, tmp_pos);
     }
+    worker_stop(&g_worker);
+    pool_free(&g_pool);
     arena_clean(&t);
     scratch = nullptr;
 
@@ -3,4 +3,10 @@
 
 GenEnumSrc(NodeType, NodeDataTable)
 GenEnumSrc(BytecodeType, BytecodeTypeTable)
+GenEnumSrc(RegBytecodeType, RegBytecodeTypeTable)
+GenEnumSrc(IrOp, IrOpTable)
+GenEnumSrc(IrPass, IrPassTable)
+GenEnumSrc(CompilePhase, CompilePhaseTable)
+GenEnumSrc(VmMode, VmModeTable)
+GenEnumSrc(ExecuteStatus, ExecuteStatusTable)
 GenEnumSrc(ItemType, ItemTypeTable)
@@ -21,13 +21,89 @@ X(TOKEN_CLOSEPAREN) \
 X(BYTECODE_INVALID) \
 X(BYTECODE_CALL) \
 X(BYTECODE_RETURN) \
+X(BYTECODE_RETURN0) \
+X(BYTECODE_RETURN1) \
+X(BYTECODE_RETURN2) \
+X(BYTECODE_RETURN3) \
 X(BYTECODE_PUSH_ARG) \
+X(BYTECODE_PUSH_LOCAL) \
 X(BYTECODE_PUSH) \
+X(BYTECODE_PUSH_GLOBAL) \
 X(BYTECODE_NEG) \
 X(BYTECODE_ADD) \
 X(BYTECODE_SUB) \
 X(BYTECODE_MUL) \
 X(BYTECODE_DIV) \
+X(BYTECODE_ADD_ARG) \
+X(BYTECODE_SUB_ARG) \
+X(BYTECODE_MUL_ARG) \
+X(BYTECODE_DIV_ARG) \
+X(BYTECODE_ADD_CONST) \
+X(BYTECODE_SUB_CONST) \
+X(BYTECODE_MUL_CONST) \
+X(BYTECODE_DIV_CONST) \
+X(BYTECODE_MULADD) \
+X(BYTECODE_ADDADD) \
+
+// dst, a, b are register indices relative to the current frame
+#define RegBytecodeTypeTable(X) \
+X(REG_BYTECODE_INVALID) \
+X(REG_BYTECODE_CALL) \
+X(REG_BYTECODE_RETURN) \
+X(REG_BYTECODE_LOADK) \
+X(REG_BYTECODE_LOAD_GLOBAL) \
+X(REG_BYTECODE_MOVE) \
+X(REG_BYTECODE_NEG) \
+X(REG_BYTECODE_ADD) \
+X(REG_BYTECODE_SUB) \
+X(REG_BYTECODE_MUL) \
+X(REG_BYTECODE_DIV) \
+
+// one ssa value per instruction, see IrInst
+#define IrOpTable(X) \
+X(IR_INVALID) \
+X(IR_CONST) \
+X(IR_PARAM) \
+X(IR_GLOBAL) \
+X(IR_CALL) \
+X(IR_NEG) \
+X(IR_ADD) \
+X(IR_SUB) \
+X(IR_MUL) \
+X(IR_DIV) \
+
+#define IrPassTable(X) \
+X(IR_PASS_BUILD) \
+X(IR_PASS_INLINE) \
+X(IR_PASS_CONSTPROP) \
+X(IR_PASS_CSE) \
+X(IR_PASS_DCE) \
+X(IR_PASS_LOWER) \
+
+// in the order compile runs them, compile_units has no graphviz
+#define CompilePhaseTable(X) \
+X(PHASE_TOKENIZE) \
+X(PHASE_PARSE) \
+X(PHASE_GRAPHVIZ) \
+X(PHASE_TYPECHECK) \
+X(PHASE_FOLD) \
+X(PHASE_INLINE) \
+X(PHASE_CSE) \
+X(PHASE_BYTECODE) \
+X(PHASE_EVALUATE) \
+
+#define VmModeTable(X) \
+X(VM_STACK) \
+X(VM_REGISTER) \
+X(VM_THREADED) \
+X(VM_JIT) \
+X(VM_COMPACT) \
+
+#define ExecuteStatusTable(X) \
+X(EXECUTE_IDLE) \
+X(EXECUTE_SUSPENDED) \
+X(EXECUTE_DONE) \
+X(EXECUTE_ERROR) \
 
 
 // type, precedence, is_left_associative, is_expr,
@@ -106,6 +182,12 @@ enum name { \
 
 GenEnum(NodeType, NodeDataTable)
 GenEnum(BytecodeType, BytecodeTypeTable)
+GenEnum(RegBytecodeType, RegBytecodeTypeTable)
+GenEnum(IrOp, IrOpTable)
+GenEnum(IrPass, IrPassTable)
+GenEnum(CompilePhase, CompilePhaseTable)
+GenEnum(VmMode, VmModeTable)
+GenEnum(ExecuteStatus, ExecuteStatusTable)
 GenEnum(ItemType, ItemTypeTable)
 GenEnum(MouseAction, MouseActionsTable)
 
@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include "pool.h"
+
+
+bool deque_push(Pool *pool, TaskDeque *deque, Task task) {
+    mutex_lock(&deque->lock);
+    bool pushed = deque->bottom - deque->top < POOL_DEQUE_CAP;
+    if (pushed) {
+        deque->tasks[deque->bottom % POOL_DEQUE_CAP] = task;
+        deque->bottom += 1;
+        atomic_add(&pool->queued, 1);
+    }
+    mutex_unlock(&deque->lock);
+    return pushed;
+}
+
+bool deque_pop(Pool *pool, TaskDeque *deque, Task *task_out) {
+    mutex_lock(&deque->lock);
+    bool popped = deque->bottom > deque->top;
+    if (popped) {
+        deque->bottom -= 1;
+        *task_out = deque->tasks[deque->bottom % POOL_DEQUE_CAP];
+        atomic_add(&pool->queued, (u32)-1);
+    }
+    mutex_unlock(&deque->lock);
+    return popped;
+}
+
+bool deque_steal(Pool *pool, TaskDeque *deque, Task *task_out) {
+    mutex_lock(&deque->lock);
+    bool stolen = deque->bottom > deque->top;
+    if (stolen) {
+        *task_out = deque->tasks[deque->top % POOL_DEQUE_CAP];
+        deque->top += 1;
+        atomic_add(&pool->queued, (u32)-1);
+    }
+    mutex_unlock(&deque->lock);
+    return stolen;
+}
+
+// own tasks newest first so they are still in cache, then the oldest task of someone else
+bool pool_find_task(PoolWorker *worker, Task *task_out) {
+    Pool *pool = worker->pool;
+    if (deque_pop(pool, &worker->deque, task_out)) return true;
+    if (atomic_load(&pool->queued) == 0) return false;
+
+    // different victims each time so thieves do not all line up on the same deque
+    worker->steal_seed = worker->steal_seed * 6364136223846793005ull + 1442695040888963407ull;
+    u32 start = (u32)(worker->steal_seed >> 33) % pool->worker_count;
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        PoolWorker *victim = pool->workers + (start + i) % pool->worker_count;
+        if (victim == worker) continue;
+        if (deque_steal(pool, &victim->deque, task_out)) return true;
+    }
+    return false;
+}
+
+void pool_run(PoolWorker *worker, Task *task) {
+    task->proc(worker, task->data, task->begin, task->end);
+    if (task->group) atomic_add(&task->group->pending, (u32)-1);
+}
+
+// takes one sleeper off the count and wakes it, the count tells how many waits have no signal yet
+void pool_wake_one(Pool *pool) {
+    u32 sleeping = atomic_load(&pool->sleeping);
+    while (sleeping > 0) {
+        u32 prev = atomic_compare_exchange(&pool->sleeping, sleeping, sleeping - 1);
+        if (prev == sleeping) {
+            semaphore_signal(&pool->wake);
+            return;
+        }
+        sleeping = prev;
+    }
+}
+
+void pool_push(PoolWorker *worker, Task task) {
+    if (task.group) atomic_add(&task.group->pending, 1);
+    if (!deque_push(worker->pool, &worker->deque, task)) {
+        // full, nobody is keeping up so running it here loses nothing
+        pool_run(worker, &task);
+        return;
+    }
+    pool_wake_one(worker->pool);
+}
+
+void pool_worker_main(void *data) {
+    PoolWorker *worker = (PoolWorker *)data;
+    Pool *pool = worker->pool;
+
+    u32 idle_rounds = 0;
+    while (!atomic_load(&pool->quit)) {
+        Task task = {};
+        if (pool_find_task(worker, &task)) {
+            pool_run(worker, &task);
+            idle_rounds = 0;
+            continue;
+        }
+        idle_rounds += 1;
+        if (idle_rounds < POOL_SPIN_ROUNDS) {
+            thread_yield();
+            continue;
+        }
+        idle_rounds = 0;
+
+        // a push after the increment sees this worker as sleeping, one before it is seen below
+        atomic_add(&pool->sleeping, 1);
+        if (atomic_load(&pool->queued) > 0 || atomic_load(&pool->quit)) {
+            // take the count back unless a pusher already did and signaled for it
+            u32 sleeping = atomic_load(&pool->sleeping);
+            bool taken_back = false;
+            while (sleeping > 0 && !taken_back) {
+                u32 prev = atomic_compare_exchange(&pool->sleeping, sleeping, sleeping - 1);
+                taken_back = prev == sleeping;
+                sleeping = prev;
+            }
+            if (taken_back) continue;
+        }
+        semaphore_wait(&pool->wake);
+    }
+}
+
+bool pool_init(Pool *pool, u32 thread_count) {
+    *pool = {};
+    pool->worker_count = thread_count + 1;
+    pool->workers = (PoolWorker *)calloc(pool->worker_count, sizeof(PoolWorker));
+    if (!pool->workers) return false;
+    if (!semaphore_init(&pool->wake, 0)) {
+        free(pool->workers);
+        *pool = {};
+        return false;
+    }
+
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        PoolWorker *worker = pool->workers + i;
+        worker->pool = pool;
+        worker->index = i;
+        worker->steal_seed = i + 1;
+        arena_init(&worker->scratch, POOL_SCRATCH_SIZE);
+    }
+    for (u32 i = 1; i < pool->worker_count; ++i) {
+        if (!thread_create(&pool->workers[i].thread, pool_worker_main, pool->workers + i)) {
+            // the pool runs with the threads that started, pool_free only sees those
+            for (u32 j = i; j < pool->worker_count; ++j) {
+                arena_clean(&pool->workers[j].scratch);
+            }
+            pool->worker_count = i;
+            break;
+        }
+    }
+    return true;
+}
+
+void pool_free(Pool *pool) {
+    atomic_store(&pool->quit, 1);
+    for (u32 i = 1; i < pool->worker_count; ++i) {
+        semaphore_signal(&pool->wake);
+    }
+    for (u32 i = 1; i < pool->worker_count; ++i) {
+        thread_join(&pool->workers[i].thread);
+    }
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        arena_clean(&pool->workers[i].scratch);
+    }
+    free(pool->workers);
+    *pool = {};
+}
+
+PoolWorker *pool_enter(Pool *pool) {
+    mutex_lock(&pool->enter_lock);
+    return pool->workers;
+}
+
+void pool_leave(PoolWorker *worker) {
+    assert(worker->index == 0);
+    assert(worker->deque.bottom == worker->deque.top);
+    mutex_unlock(&worker->pool->enter_lock);
+}
+
+void pool_spawn(PoolWorker *worker, TaskGroup *group, TaskProc proc, void *data) {
+    Task task = {};
+    task.proc = proc;
+    task.data = data;
+    task.group = group;
+    pool_push(worker, task);
+}
+
+// runs other tasks while waiting so a worker blocked in a join is never idle
+void pool_wait(PoolWorker *worker, TaskGroup *group) {
+    while (atomic_load(&group->pending) != 0) {
+        Task task = {};
+        if (pool_find_task(worker, &task)) {
+            pool_run(worker, &task);
+        } else {
+            thread_yield();
+        }
+    }
+}
+
+struct ParallelFor {
+    TaskProc proc;
+    void *data;
+    u64 grain;
+    TaskGroup group;
+};
+
+// keeps the left half and leaves the right half for thieves until the range is one chunk, so
+// an idle worker steals the biggest piece left
+void parallel_for_split(PoolWorker *worker, void *data, u64 begin, u64 end) {
+    ParallelFor *pf = (ParallelFor *)data;
+    while (end - begin > pf->grain) {
+        u64 mid = begin + (end - begin) / 2;
+        Task task = {};
+        task.proc = parallel_for_split;
+        task.data = pf;
+        task.group = &pf->group;
+        task.begin = mid;
+        task.end = end;
+        pool_push(worker, task);
+        end = mid;
+    }
+    pf->proc(worker, pf->data, begin, end);
+}
+
+void pool_parallel_for(PoolWorker *worker, u64 count, u64 grain, TaskProc proc, void *data) {
+    if (count == 0) return;
+    ParallelFor pf = {};
+    pf.proc = proc;
+    pf.data = data;
+    pf.grain = grain > 0 ? grain : 1;
+    parallel_for_split(worker, &pf, 0, count);
+    pool_wait(worker, &pf.group);
+}
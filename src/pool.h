@@ -0,0 +1,80 @@
+#pragma once
+#include "common.h"
+#include "arena.h"
+#include "thread.h"
+
+struct Pool;
+struct PoolWorker;
+
+// begin and end are the range of a pool_parallel_for chunk, both 0 for spawned tasks
+typedef void (*TaskProc)(PoolWorker *worker, void *data, u64 begin, u64 end);
+
+// tasks spawned into the group that have not finished yet
+struct TaskGroup {
+    volatile u32 pending;
+};
+
+struct Task {
+    TaskProc proc;
+    void *data;
+    TaskGroup *group;
+    u64 begin;
+    u64 end;
+};
+
+#define POOL_DEQUE_CAP 1024
+#define POOL_SCRATCH_SIZE (16ull << 20)
+// yields before an idle worker goes to sleep on Pool::wake
+#define POOL_SPIN_ROUNDS 64
+
+// the owning worker pushes and pops at bottom, other workers steal from top
+struct TaskDeque {
+    Mutex lock;
+    u64 top;
+    u64 bottom;
+    Task tasks[POOL_DEQUE_CAP];
+};
+
+struct PoolWorker {
+    Pool *pool;
+    u32 index;
+    Thread thread;
+    u64 steal_seed;
+
+    // scratch memory of the tasks run by this worker, a task sets the position back before it
+    // returns since tasks run nested inside pool_wait
+    Arena scratch;
+
+    TaskDeque deque;
+};
+
+// work stealing scheduler, worker 0 is whichever thread is between pool_enter and pool_leave
+// and the others have a thread each
+struct Pool {
+    PoolWorker *workers;
+    u32 worker_count;
+
+    Mutex enter_lock;
+
+    // idle workers sleep on wake, sleeping counts the ones that have not been signaled yet
+    Semaphore wake;
+    volatile u32 sleeping;
+    // tasks in all deques
+    volatile u32 queued;
+    volatile u32 quit;
+};
+
+// thread_count 0 runs every task on the thread inside pool_enter
+bool pool_init(Pool *pool, u32 thread_count);
+void pool_free(Pool *pool);
+
+// one thread at a time, others wait
+PoolWorker *pool_enter(Pool *pool);
+void pool_leave(PoolWorker *worker);
+
+// fork and join, spawn from any task or from worker 0 and wait before data goes away
+void pool_spawn(PoolWorker *worker, TaskGroup *group, TaskProc proc, void *data);
+void pool_wait(PoolWorker *worker, TaskGroup *group);
+
+// calls proc on chunks of at most grain items covering 0..count and returns once all are done
+void pool_parallel_for(PoolWorker *worker, u64 count, u64 grain, TaskProc proc, void *data);
@@ -0,0 +1,135 @@
+#include <immintrin.h>
+#include "simd.h"
+
+#ifdef MSVC
+    #include <intrin.h>
+    #define TARGET_AVX2
+#else
+    #include <cpuid.h>
+    #define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+SimdLevel simd_level = SIMD_SSE2;
+SimdKernels simd_kernels = {};
+
+
+void cpuid(u32 leaf, u32 subleaf, u32 out[4]) {
+#ifdef MSVC
+    __cpuidex((int *)out, (int)leaf, (int)subleaf);
+#else
+    __get_cpuid_count(leaf, subleaf, out + 0, out + 1, out + 2, out + 3);
+#endif
+}
+
+u64 xgetbv0() {
+#ifdef MSVC
+    return _xgetbv(0);
+#else
+    u32 lo = 0;
+    u32 hi = 0;
+    asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((u64)hi << 32) | lo;
+#endif
+}
+
+SimdLevel simd_detect() {
+    u32 regs[4] = {};
+    cpuid(0, 0, regs);
+    u32 max_leaf = regs[0];
+    if (max_leaf < 7) return SIMD_SSE2;
+
+    cpuid(1, 0, regs);
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool avx = (regs[2] & (1u << 28)) != 0;
+    if (!osxsave || !avx) return SIMD_SSE2;
+
+    // the os has to save the ymm registers on context switches
+    if ((xgetbv0() & 0x6) != 0x6) return SIMD_SSE2;
+
+    cpuid(7, 0, regs);
+    bool avx2 = (regs[1] & (1u << 5)) != 0;
+    if (!avx2) return SIMD_SSE2;
+
+    return SIMD_AVX2;
+}
+
+
+#define SIMD_SSE2_BINOP(name, op) \
+void name##_sse2(f64 *dst, f64 *a, f64 *b, u64 count) { \
+    u64 i = 0; \
+    for (; i + 2 <= count; i += 2) { \
+        _mm_storeu_pd(dst + i, op(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))); \
+    } \
+    for (; i < count; ++i) { \
+        _mm_store_sd(dst + i, op(_mm_load_sd(a + i), _mm_load_sd(b + i))); \
+    } \
+}
+
+#define SIMD_AVX2_BINOP(name, op, op_sse2) \
+TARGET_AVX2 void name##_avx2(f64 *dst, f64 *a, f64 *b, u64 count) { \
+    u64 i = 0; \
+    for (; i + 4 <= count; i += 4) { \
+        _mm256_storeu_pd(dst + i, op(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+    } \
+    for (; i < count; ++i) { \
+        _mm_store_sd(dst + i, op_sse2(_mm_load_sd(a + i), _mm_load_sd(b + i))); \
+    } \
+}
+
+SIMD_SSE2_BINOP(add, _mm_add_pd)
+SIMD_SSE2_BINOP(sub, _mm_sub_pd)
+SIMD_SSE2_BINOP(mul, _mm_mul_pd)
+SIMD_SSE2_BINOP(div, _mm_div_pd)
+
+SIMD_AVX2_BINOP(add, _mm256_add_pd, _mm_add_pd)
+SIMD_AVX2_BINOP(sub, _mm256_sub_pd, _mm_sub_pd)
+SIMD_AVX2_BINOP(mul, _mm256_mul_pd, _mm_mul_pd)
+SIMD_AVX2_BINOP(div, _mm256_div_pd, _mm_div_pd)
+
+void neg_sse2(f64 *dst, f64 *a, u64 count) {
+    __m128d sign = _mm_set1_pd(-0.0);
+    u64 i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(dst + i, _mm_xor_pd(_mm_loadu_pd(a + i), sign));
+    }
+    for (; i < count; ++i) {
+        dst[i] = -a[i];
+    }
+}
+
+TARGET_AVX2 void neg_avx2(f64 *dst, f64 *a, u64 count) {
+    __m256d sign = _mm256_set1_pd(-0.0);
+    u64 i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+    }
+    for (; i < count; ++i) {
+        dst[i] = -a[i];
+    }
+}
+
+
+void simd_init() {
+    simd_select(simd_detect());
+}
+
+// the level has to be supported by the cpu
+void simd_select(SimdLevel level) {
+    simd_level = level;
+    switch (simd_level) {
+        case SIMD_SSE2: {
+            simd_kernels.add = add_sse2;
+            simd_kernels.sub = sub_sse2;
+            simd_kernels.mul = mul_sse2;
+            simd_kernels.div = div_sse2;
+            simd_kernels.neg = neg_sse2;
+        } break;
+        case SIMD_AVX2: {
+            simd_kernels.add = add_avx2;
+            simd_kernels.sub = sub_avx2;
+            simd_kernels.mul = mul_avx2;
+            simd_kernels.div = div_avx2;
+            simd_kernels.neg = neg_avx2;
+        } break;
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "common.h"
+
+enum SimdLevel {
+    SIMD_SSE2,
+    SIMD_AVX2,
+};
+
+// dst = a op b for count doubles, dst may alias a or b
+struct SimdKernels {
+    void (*add)(f64 *dst, f64 *a, f64 *b, u64 count);
+    void (*sub)(f64 *dst, f64 *a, f64 *b, u64 count);
+    void (*mul)(f64 *dst, f64 *a, f64 *b, u64 count);
+    void (*div)(f64 *dst, f64 *a, f64 *b, u64 count);
+    void (*neg)(f64 *dst, f64 *a, u64 count);
+};
+
+extern SimdLevel simd_level;
+extern SimdKernels simd_kernels;
+
+SimdLevel simd_detect();
+void simd_init();
+void simd_select(SimdLevel level);
@@ -19,6 +19,16 @@ String string_printf(Arena *arena, const char *fmt, ...) {
     return s;
 }
 
+// FNV-1a
+u64 string_hash(String s) {
+    u64 h = 0xcbf29ce484222325ull;
+    for (u64 i = 0; i < s.count; ++i) {
+        h ^= s.dat[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
 bool string_equal(String a, String b) {
     if (a.count != b.count) return false;
 
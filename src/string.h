@@ -14,4 +14,5 @@ struct String {
 __attribute__((__format__ (__printf__, 2, 3)))
 #endif
 String string_printf(Arena *arena, const char *fmt, ...);
-bool string_equal(String a, String b);
\ No newline at end of file
+bool string_equal(String a, String b);
+u64 string_hash(String s);
\ No newline at end of file
@@ -0,0 +1,110 @@
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include "thread.h"
+
+struct Thread_Internal {
+    HANDLE handle;
+};
+
+struct Mutex_Internal {
+    SRWLOCK lock;
+};
+
+struct Semaphore_Internal {
+    HANDLE handle;
+};
+
+struct ThreadStart {
+    ThreadProc proc;
+    void *data;
+};
+
+DWORD WINAPI thread_start(LPVOID param) {
+    ThreadStart start = *(ThreadStart *)param;
+    HeapFree(GetProcessHeap(), 0, param);
+    start.proc(start.data);
+    return 0;
+}
+
+bool thread_create(Thread *thread, ThreadProc proc, void *data) {
+    Thread_Internal *t = (Thread_Internal *)thread;
+
+    ThreadStart *start = (ThreadStart *)HeapAlloc(GetProcessHeap(), 0, sizeof(*start));
+    if (!start) return false;
+    start->proc = proc;
+    start->data = data;
+
+    t->handle = CreateThread(nullptr, 0, thread_start, start, 0, nullptr);
+    if (!t->handle) {
+        HeapFree(GetProcessHeap(), 0, start);
+        return false;
+    }
+    return true;
+}
+
+void thread_join(Thread *thread) {
+    Thread_Internal *t = (Thread_Internal *)thread;
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    t->handle = nullptr;
+}
+
+void mutex_lock(Mutex *mutex) {
+    AcquireSRWLockExclusive(&((Mutex_Internal *)mutex)->lock);
+}
+
+void mutex_unlock(Mutex *mutex) {
+    ReleaseSRWLockExclusive(&((Mutex_Internal *)mutex)->lock);
+}
+
+bool semaphore_init(Semaphore *semaphore, u32 initial_count) {
+    Semaphore_Internal *s = (Semaphore_Internal *)semaphore;
+    s->handle = CreateSemaphoreA(nullptr, (LONG)initial_count, MAXLONG, nullptr);
+    return s->handle != nullptr;
+}
+
+void semaphore_wait(Semaphore *semaphore) {
+    WaitForSingleObject(((Semaphore_Internal *)semaphore)->handle, INFINITE);
+}
+
+void semaphore_signal(Semaphore *semaphore) {
+    ReleaseSemaphore(((Semaphore_Internal *)semaphore)->handle, 1, nullptr);
+}
+
+u32 atomic_load(volatile u32 *src) {
+    return (u32)InterlockedCompareExchange((volatile LONG *)src, 0, 0);
+}
+
+void atomic_store(volatile u32 *dst, u32 v) {
+    InterlockedExchange((volatile LONG *)dst, (LONG)v);
+}
+
+u32 atomic_exchange(volatile u32 *dst, u32 v) {
+    return (u32)InterlockedExchange((volatile LONG *)dst, (LONG)v);
+}
+
+u32 atomic_add(volatile u32 *dst, u32 v) {
+    return (u32)InterlockedExchangeAdd((volatile LONG *)dst, (LONG)v);
+}
+
+u32 atomic_compare_exchange(volatile u32 *dst, u32 expected, u32 desired) {
+    return (u32)InterlockedCompareExchange((volatile LONG *)dst, (LONG)desired, (LONG)expected);
+}
+
+void thread_yield() {
+    SwitchToThread();
+}
+
+u32 processor_count() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (u32)info.dwNumberOfProcessors : 1;
+}
+
+f64 time_seconds() {
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (f64)counter.QuadPart / (f64)frequency.QuadPart;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "common.h"
+
+struct Thread {
+    u64 d[2];
+};
+
+struct Mutex {
+    u64 d[2];
+};
+
+struct Semaphore {
+    u64 d[2];
+};
+
+typedef void (*ThreadProc)(void *data);
+
+bool thread_create(Thread *thread, ThreadProc proc, void *data);
+void thread_join(Thread *thread);
+
+// a zero initialized Mutex is unlocked
+void mutex_lock(Mutex *mutex);
+void mutex_unlock(Mutex *mutex);
+
+bool semaphore_init(Semaphore *semaphore, u32 initial_count);
+void semaphore_wait(Semaphore *semaphore);
+void semaphore_signal(Semaphore *semaphore);
+
+// sequentially consistent
+u32 atomic_load(volatile u32 *src);
+void atomic_store(volatile u32 *dst, u32 v);
+u32 atomic_exchange(volatile u32 *dst, u32 v);
+// both return the previous value
+u32 atomic_add(volatile u32 *dst, u32 v);
+u32 atomic_compare_exchange(volatile u32 *dst, u32 expected, u32 desired);
+
+// gives the rest of the time slice to another thread
+void thread_yield();
+// logical processors of the machine, at least 1
+u32 processor_count();
+
+// monotonic
+f64 time_seconds();